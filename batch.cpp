@@ -0,0 +1,379 @@
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+#include <unordered_map>
+
+#include "batch.h"
+#include "logging.h"
+
+namespace rostrum::batch {
+  namespace {
+    /*
+     * Minimal parser of one JSON object per manifest line.
+     */
+    class json_line final {
+    public:
+      explicit json_line(const std::string_view text) : text_(text) {
+      }
+
+      job parse() {
+        job result;
+        auto has_script = false;
+
+        expect('{');
+        if (!consume('}')) {
+          do {
+            const auto key = string();
+            expect(':');
+            if (key == "script") {
+              result.run.script = string();
+              has_script = true;
+            }
+            else if (key == "args") {
+              expect('[');
+              if (!consume(']')) {
+                do {
+                  result.run.args.push_back(scalar());
+                } while (consume(','));
+                expect(']');
+              }
+            }
+            else if (key == "log") {
+              result.log = string();
+            }
+            else {
+              throw std::runtime_error("unknown key '" + key + "'");
+            }
+          } while (consume(','));
+          expect('}');
+        }
+        skip_space();
+        if (pos_ != std::size(text_)) {
+          throw std::runtime_error("trailing characters after object");
+        }
+        if (!has_script) {
+          throw std::runtime_error("job has no script");
+        }
+        return result;
+      }
+
+    private:
+      void skip_space() {
+        while (pos_ < std::size(text_) && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\r')) {
+          ++pos_;
+        }
+      }
+
+      bool consume(const char c) {
+        skip_space();
+        if (pos_ < std::size(text_) && text_[pos_] == c) {
+          ++pos_;
+          return true;
+        }
+        return false;
+      }
+
+      void expect(const char c) {
+        if (!consume(c)) {
+          throw std::runtime_error(std::string("expected '") + c + "' at column " + std::to_string(pos_ + 1));
+        }
+      }
+
+      // strings as is, numbers and booleans as their text
+      std::string scalar() {
+        skip_space();
+        if (pos_ < std::size(text_) && text_[pos_] == '"') {
+          return string();
+        }
+        const auto begin = pos_;
+        while (pos_ < std::size(text_) && text_[pos_] != ',' && text_[pos_] != ']' && text_[pos_] != ' ' && text_[pos_] != '\t') {
+          ++pos_;
+        }
+        if (begin == pos_) {
+          throw std::runtime_error("expected value at column " + std::to_string(pos_ + 1));
+        }
+        return std::string(text_.substr(begin, pos_ - begin));
+      }
+
+      std::string string() {
+        expect('"');
+        std::string result;
+        while (pos_ < std::size(text_) && text_[pos_] != '"') {
+          const auto c = text_[pos_++];
+          if (c != '\\') {
+            result.push_back(c);
+            continue;
+          }
+          if (pos_ == std::size(text_)) {
+            break;
+          }
+          switch (const auto e = text_[pos_++]) {
+          case 'n': result.push_back('\n'); break;
+          case 't': result.push_back('\t'); break;
+          case 'r': result.push_back('\r'); break;
+          case 'b': result.push_back('\b'); break;
+          case 'f': result.push_back('\f'); break;
+          case 'u': utf8(result, hex4()); break;
+          default: result.push_back(e); break;
+          }
+        }
+        expect('"');
+        return result;
+      }
+
+      unsigned hex4() {
+        if (std::size(text_) - pos_ < 4) {
+          throw std::runtime_error("truncated \\u escape");
+        }
+        unsigned value = 0;
+        for (auto i = 0; i < 4; ++i) {
+          const auto c = text_[pos_++];
+          value <<= 4;
+          if (c >= '0' && c <= '9') {
+            value |= static_cast<unsigned>(c - '0');
+          }
+          else if (c >= 'a' && c <= 'f') {
+            value |= static_cast<unsigned>(c - 'a' + 10);
+          }
+          else if (c >= 'A' && c <= 'F') {
+            value |= static_cast<unsigned>(c - 'A' + 10);
+          }
+          else {
+            throw std::runtime_error("invalid \\u escape");
+          }
+        }
+        return value;
+      }
+
+      // surrogate pairs are not joined. paths and args are expected to be plain text
+      static void utf8(std::string& out, const unsigned cp) {
+        if (cp < 0x80) {
+          out.push_back(static_cast<char>(cp));
+        }
+        else if (cp < 0x800) {
+          out.push_back(static_cast<char>(0xc0 | (cp >> 6)));
+          out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        }
+        else {
+          out.push_back(static_cast<char>(0xe0 | (cp >> 12)));
+          out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+          out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        }
+      }
+
+      std::string_view text_;
+      std::size_t pos_{ 0 };
+    };
+
+    job parse_plain(const std::string_view line) {
+      std::vector<std::string> tokens;
+      std::size_t i = 0;
+      while (i < std::size(line)) {
+        if (line[i] == ' ' || line[i] == '\t' || line[i] == '\r') {
+          ++i;
+          continue;
+        }
+        std::string token;
+        if (line[i] == '"') {
+          const auto end = line.find('"', i + 1);
+          if (end == std::string_view::npos) {
+            throw std::runtime_error("unterminated quote");
+          }
+          token = line.substr(i + 1, end - i - 1);
+          i = end + 1;
+        }
+        else {
+          const auto end = line.find_first_of(" \t\r", i);
+          token = line.substr(i, end == std::string_view::npos ? std::string_view::npos : end - i);
+          i = end == std::string_view::npos ? std::size(line) : end;
+        }
+        tokens.push_back(std::move(token));
+      }
+
+      job result;
+      result.run.script = std::move(tokens.front());
+      result.run.args.assign(std::make_move_iterator(std::begin(tokens) + 1), std::make_move_iterator(std::end(tokens)));
+      return result;
+    }
+
+    /*
+     * Output and log records of one job. Written from job thread and async logger thread.
+     */
+    class job_log final {
+    public:
+      explicit job_log(const std::string& path) : file_(std::fopen(path.c_str(), "wb")) {
+        if (file_ == nullptr) {
+          throw std::runtime_error("cannot open job log '" + path + "'");
+        }
+      }
+
+      job_log(const job_log&) = delete;
+      job_log& operator= (const job_log&) = delete;
+
+      ~job_log() {
+        std::fclose(file_);
+      }
+
+      void write(const std::string_view text) {
+        std::scoped_lock lock(mutex_);
+        std::fwrite(std::data(text), 1, std::size(text), file_);
+      }
+
+    private:
+      std::mutex mutex_;
+      std::FILE* file_;
+    };
+
+    // jobs must not share a log file
+    std::string log_key(const std::string& path) {
+      return std::filesystem::absolute(path).lexically_normal().string();
+    }
+
+    std::chrono::nanoseconds percentile(const std::vector<std::chrono::nanoseconds>& sorted, const double p) {
+      const auto index = static_cast<std::size_t>(p * static_cast<double>(std::size(sorted) - 1) + 0.5);
+      return sorted[(std::min)(index, std::size(sorted) - 1)];
+    }
+  }
+
+  std::vector<job> read_manifest(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+      throw std::runtime_error("cannot open batch manifest '" + path + "'");
+    }
+
+    std::vector<job> jobs;
+    // log path to line of the job writing it
+    std::unordered_map<std::string, std::size_t> logs;
+    std::string line;
+    for (std::size_t number = 1; std::getline(in, line); ++number) {
+      const auto first = line.find_first_not_of(" \t\r");
+      if (first == std::string::npos || line[first] == '#') {
+        continue;
+      }
+      try {
+        const std::string_view text = std::string_view(line).substr(first);
+        auto& j = jobs.emplace_back(text.front() == '{' ? json_line(text).parse() : parse_plain(text));
+        if (!j.log.empty()) {
+          const auto [it, inserted] = logs.try_emplace(log_key(j.log), number);
+          if (!inserted) {
+            throw std::runtime_error("log '" + j.log + "' is already written by the job on line " + std::to_string(it->second));
+          }
+        }
+      }
+      catch (const std::exception& e) {
+        throw std::runtime_error(path + ':' + std::to_string(number) + ": " + e.what());
+      }
+    }
+    return jobs;
+  }
+
+  summary run(const options& opts) {
+    using namespace std::chrono;
+
+    const auto jobs = read_manifest(opts.manifest);
+    std::vector<script_result> results(std::size(jobs));
+    // jobs which failed before the script ran are kept out of latency
+    std::vector<char> ran(std::size(jobs), 0);
+
+    if (!opts.log_dir.empty()) {
+      std::filesystem::create_directories(opts.log_dir);
+    }
+    // generated log names must not collide with logs named in the manifest
+    std::vector<std::string> log_paths(std::size(jobs));
+    std::unordered_map<std::string, std::size_t> logs;
+    for (std::size_t i = 0; i < std::size(jobs); ++i) {
+      log_paths[i] = jobs[i].log;
+      if (log_paths[i].empty() && !opts.log_dir.empty()) {
+        log_paths[i] = (std::filesystem::path(opts.log_dir) / ("job-" + std::to_string(i + 1) + ".log")).string();
+      }
+      if (log_paths[i].empty()) {
+        continue;
+      }
+      if (const auto [it, inserted] = logs.try_emplace(log_key(log_paths[i]), i); !inserted) {
+        throw std::runtime_error("jobs " + std::to_string(it->second + 1) + " and " + std::to_string(i + 1) + " would both write log '" + log_paths[i] + "'");
+      }
+    }
+
+    const auto threads = (std::max)(std::size_t{ 1 }, (std::min)(opts.threads, std::size(jobs)));
+    spdlog::info("batch: {} jobs from '{}' on {} threads", std::size(jobs), opts.manifest, threads);
+
+    std::atomic<std::size_t> next{ 0 };
+    const auto worker = [&] {
+      script_runner runner;
+      runner.prepare();
+      for (auto i = next.fetch_add(1); i < std::size(jobs); i = next.fetch_add(1)) {
+        const auto& j = jobs[i];
+        const auto& log_path = log_paths[i];
+
+        try {
+          if (log_path.empty()) {
+            results[i] = runner.run(j.run);
+            ran[i] = 1;
+          }
+          else {
+            job_log log(log_path);
+            results[i] = runner.run(j.run, [&log](const std::string_view text) {
+              log.write(text);
+            }, [&log](spdlog::level::level_enum, const std::string_view text) {
+              log.write(text);
+            });
+            ran[i] = 1;
+          }
+        }
+        catch (const std::exception& e) {
+          results[i] = { EXIT_FAILURE, e.what(), {} };
+        }
+
+        if (results[i].exit_code != EXIT_SUCCESS) {
+          spdlog::warn("batch: job {} '{}' failed with {}: {}", i + 1, j.run.script, results[i].exit_code, results[i].error);
+        }
+        else {
+          spdlog::debug("batch: job {} '{}' done in {} us", i + 1, j.run.script, duration_cast<microseconds>(results[i].elapsed).count());
+        }
+        runner.prepare();
+      }
+    };
+
+    const auto begin = steady_clock::now();
+    {
+      std::vector<std::jthread> pool;
+      for (std::size_t i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+      }
+      worker();
+    }
+
+    summary s{};
+    s.jobs = std::size(jobs);
+    s.wall = steady_clock::now() - begin;
+    s.jobs_per_second = static_cast<double>(s.jobs) / (std::max)(duration<double>(s.wall).count(), 1e-9);
+
+    std::vector<nanoseconds> latencies;
+    latencies.reserve(std::size(results));
+    for (std::size_t i = 0; i < std::size(results); ++i) {
+      s.failed += results[i].exit_code != EXIT_SUCCESS ? 1 : 0;
+      if (ran[i] != 0) {
+        latencies.push_back(results[i].elapsed);
+      }
+    }
+    s.measured = std::size(latencies);
+    if (!latencies.empty()) {
+      std::sort(std::begin(latencies), std::end(latencies));
+      s.min = latencies.front();
+      s.median = percentile(latencies, 0.5);
+      s.p90 = percentile(latencies, 0.9);
+      s.p99 = percentile(latencies, 0.99);
+      s.max = latencies.back();
+    }
+
+    const auto ms = [](const nanoseconds ns) { return duration<double, std::milli>(ns).count(); };
+    spdlog::info("batch: {} jobs, {} failed in {:.3f} s, {:.1f} jobs/s", s.jobs, s.failed, duration<double>(s.wall).count(), s.jobs_per_second);
+    spdlog::info("batch: latency of {} jobs which ran, ms min {:.3f} median {:.3f} p90 {:.3f} p99 {:.3f} max {:.3f}", s.measured, ms(s.min), ms(s.median), ms(s.p90), ms(s.p99), ms(s.max));
+    return s;
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstddef>
+
+#include "script_runner.h"
+
+/*
+ * Batch execution of many scripts or argument sets in one process.
+ * Jobs run on worker threads, each with its own states, sharing loaded rostrum modules.
+ */
+namespace rostrum::batch {
+
+  struct job {
+    script_job run;
+    // output and logs of the job are written to this file if not empty
+    std::string log;
+  };
+
+  struct options {
+    std::string manifest;
+    std::size_t threads = 1;
+    // jobs without own log file write to DIR/job-N.log if not empty
+    std::string log_dir;
+  };
+
+  struct summary {
+    std::size_t jobs;
+    std::size_t failed;
+    std::chrono::nanoseconds wall;
+    double jobs_per_second;
+    // latency of jobs whose script ran. jobs failed before, e.g. on opening log, are not measured
+    std::size_t measured;
+    std::chrono::nanoseconds min, median, p90, p99, max;
+  };
+
+  /*
+   * One job per line, empty lines and lines starting with '#' are skipped.
+   * Plain line: script and args separated by whitespace, "double quoted" args may contain spaces.
+   * JSON line: {"script": "a.rlua", "args": ["x", 1], "log": "a.log"}
+   * Throws std::runtime_error with line number on malformed lines or if two jobs write the same log
+   */
+  [[nodiscard]]
+  std::vector<job> read_manifest(const std::string& path);
+
+  // run all jobs of the manifest. per job exit status is logged
+  summary run(const options& opts);
+}
@@ -0,0 +1,342 @@
+#pragma once
+#include <new>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <system_error>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <condition_variable>
+
+#include <spdlog/common.h>
+
+#ifdef _WIN32
+# include <io.h>
+#else
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+#if defined(__linux__) && __has_include(<liburing.h>)
+# include <liburing.h>
+# define ROSTRUM_HAS_IO_URING 1
+#endif
+
+namespace rostrum::logging::detail {
+
+  /*
+   * Append-only file writing through large aligned buffers.
+   * Filled buffers are written by a background thread (through io_uring if available),
+   * so writers only wait on disk when all buffers are in flight.
+   * Failed writes are counted and reported by the next write or sync, which spdlog passes to its error handler.
+   * Drop-in replacement for spdlog::details::file_helper in temp file sinks.
+   */
+  class batched_file final {
+  public:
+    static constexpr std::size_t kBufferSize = 1024 * 1024;
+    static constexpr std::size_t kBufferCount = 4;
+    static constexpr std::size_t kAlignment = 4096;
+
+    batched_file() {
+      for (std::size_t i = 0; i < kBufferCount; ++i) {
+        buffers_.emplace_back(static_cast<char*>(::operator new(kBufferSize, std::align_val_t(kAlignment))));
+        free_.push_back(buffers_.back().get());
+      }
+#ifdef ROSTRUM_HAS_IO_URING
+      uring_ = io_uring_queue_init(kBufferCount, &ring_, 0) == 0;
+#endif
+      writer_ = std::thread(&batched_file::writer_loop, this);
+    }
+
+    batched_file(const batched_file&) = delete;
+    batched_file& operator= (const batched_file&) = delete;
+
+    ~batched_file() {
+      close();
+      {
+        std::scoped_lock lock(mutex_);
+        stop_ = true;
+      }
+      cv_.notify_all();
+      writer_.join();
+#ifdef ROSTRUM_HAS_IO_URING
+      if (uring_ && !uring_failed_) {
+        io_uring_queue_exit(&ring_);
+      }
+#endif
+    }
+
+    void open(const spdlog::filename_t& filename) {
+      close();
+#ifdef _WIN32
+      file_ = std::fopen(filename.c_str(), "ab");
+      if (file_ == nullptr) {
+#else
+      fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+      if (fd_ < 0) {
+#endif
+        throw std::runtime_error("cannot open log file '" + filename + "'");
+      }
+      filename_ = filename;
+      lost_total_.store(0, std::memory_order_relaxed);
+    }
+
+    void close() {
+      if (!is_open()) {
+        return;
+      }
+      flush();
+      wait_written();
+#ifdef _WIN32
+      std::fclose(file_);
+      file_ = nullptr;
+#else
+      ::close(fd_);
+      fd_ = -1;
+#endif
+    }
+
+    void write(const spdlog::memory_buf_t& buffer) {
+      auto data = std::data(buffer);
+      auto size = std::size(buffer);
+      while (size > 0) {
+        if (current_ == nullptr) {
+          current_ = acquire();
+        }
+        const auto n = (std::min)(size, kBufferSize - used_);
+        std::memcpy(current_ + used_, data, n);
+        used_ += n;
+        data += n;
+        size -= n;
+        if (used_ == kBufferSize) {
+          submit();
+        }
+      }
+      report_lost();
+    }
+
+    // hand partially filled buffer to the writer. does not wait for disk
+    void flush() {
+      if (current_ != nullptr && used_ > 0) {
+        submit();
+      }
+    }
+
+    // durability point: everything written so far reaches the disk
+    void sync() {
+      flush();
+      wait_written();
+#ifdef _WIN32
+      std::fflush(file_);
+      _commit(_fileno(file_));
+#elif defined(__APPLE__)
+      ::fsync(fd_);
+#else
+      ::fdatasync(fd_);
+#endif
+      report_lost();
+    }
+
+    [[nodiscard]] const spdlog::filename_t& filename() const {
+      return filename_;
+    }
+
+    // bytes the writer failed to write since open
+    [[nodiscard]] std::uint64_t lost_bytes() const noexcept {
+      return lost_total_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct aligned_deleter {
+      void operator() (char* p) const noexcept {
+        ::operator delete(p, std::align_val_t(kAlignment));
+      }
+    };
+
+    struct pending {
+      char* data;
+      std::size_t size;
+    };
+
+    [[nodiscard]] bool is_open() const noexcept {
+#ifdef _WIN32
+      return file_ != nullptr;
+#else
+      return fd_ >= 0;
+#endif
+    }
+
+    char* acquire() {
+      std::unique_lock lock(mutex_);
+      cv_.wait(lock, [this] { return !free_.empty(); });
+      const auto buffer = free_.back();
+      free_.pop_back();
+      used_ = 0;
+      return buffer;
+    }
+
+    void submit() {
+      {
+        std::scoped_lock lock(mutex_);
+        filled_.push_back({ current_, used_ });
+      }
+      cv_.notify_all();
+      current_ = nullptr;
+      used_ = 0;
+    }
+
+    void wait_written() {
+      std::unique_lock lock(mutex_);
+      cv_.wait(lock, [this] { return filled_.empty() && !writing_; });
+    }
+
+    void write_direct(const char* data, std::size_t size) {
+      while (size > 0) {
+#ifdef _WIN32
+        const auto n = std::fwrite(data, 1, size, file_);
+        if (n == 0) {
+          lose(size, errno != 0 ? errno : EIO);
+          return;
+        }
+#else
+        const auto n = ::write(fd_, data, size);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n <= 0) {
+          lose(size, n < 0 ? errno : EIO);
+          return;
+        }
+#endif
+        data += n;
+        size -= static_cast<std::size_t>(n);
+      }
+    }
+
+    // writer thread
+    void lose(const std::size_t size, const int error) noexcept {
+      error_.store(error, std::memory_order_relaxed);
+      lost_.fetch_add(size, std::memory_order_release);
+      lost_total_.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    // logging thread
+    void report_lost() {
+      if (const auto lost = lost_.exchange(0, std::memory_order_acquire); lost != 0) {
+        throw std::runtime_error("lost " + std::to_string(lost) + " bytes writing log file '" + filename_ + "': "
+          + std::system_category().message(error_.load(std::memory_order_relaxed)));
+      }
+    }
+
+    void write_batch(const std::vector<pending>& batch) {
+#ifdef ROSTRUM_HAS_IO_URING
+      if (uring_ && !uring_failed_) {
+        // linked writes keep order. offset -1 writes at current file position
+        for (const auto& p : batch) {
+          const auto sqe = io_uring_get_sqe(&ring_);
+          io_uring_prep_write(sqe, fd_, p.data, static_cast<unsigned>(p.size), static_cast<__u64>(-1));
+          sqe->flags |= IOSQE_IO_LINK;
+          io_uring_sqe_set_data(sqe, const_cast<pending*>(&p));
+        }
+        io_uring_submit_and_wait(&ring_, static_cast<unsigned>(std::size(batch)));
+
+        for (std::size_t i = 0; i < std::size(batch); ++i) {
+          io_uring_cqe* cqe;
+          auto result = io_uring_wait_cqe(&ring_, &cqe);
+          while (result == -EINTR) {
+            result = io_uring_wait_cqe(&ring_, &cqe);
+          }
+          if (result != 0) {
+            // completions of the rest are unknown, so they are lost and the ring is not used again
+            std::size_t unknown = 0;
+            for (auto j = i; j < std::size(batch); ++j) {
+              unknown += batch[j].size;
+            }
+            lose(unknown, -result);
+            uring_failed_ = true;
+            return;
+          }
+          const auto& p = *static_cast<const pending*>(io_uring_cqe_get_data(cqe));
+          const auto res = cqe->res;
+          io_uring_cqe_seen(&ring_, cqe);
+
+          // complete short or failed writes synchronously
+          const auto written = res > 0 ? static_cast<std::size_t>(res) : 0;
+          if (written < p.size) {
+            write_direct(p.data + written, p.size - written);
+          }
+        }
+        return;
+      }
+#endif
+      for (const auto& p : batch) {
+        write_direct(p.data, p.size);
+      }
+    }
+
+    void writer_loop() {
+      std::vector<pending> batch;
+      while (true) {
+        {
+          std::unique_lock lock(mutex_);
+          cv_.wait(lock, [this] { return stop_ || !filled_.empty(); });
+          if (filled_.empty()) {
+            return;
+          }
+          // at most kBufferCount buffers exist so batch always fits the ring
+          batch.assign(std::begin(filled_), std::end(filled_));
+          filled_.clear();
+          writing_ = true;
+        }
+
+        write_batch(batch);
+
+        {
+          std::scoped_lock lock(mutex_);
+          for (const auto& p : batch) {
+            free_.push_back(p.data);
+          }
+          writing_ = false;
+        }
+        cv_.notify_all();
+      }
+    }
+
+    spdlog::filename_t filename_;
+#ifdef _WIN32
+    std::FILE* file_{ nullptr };
+#else
+    int fd_{ -1 };
+#endif
+#ifdef ROSTRUM_HAS_IO_URING
+    io_uring ring_{};
+    bool uring_{ false };
+    bool uring_failed_{ false };
+#endif
+
+    // owned by the logging thread
+    char* current_{ nullptr };
+    std::size_t used_{ 0 };
+
+    std::vector<std::unique_ptr<char, aligned_deleter>> buffers_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<char*> free_;
+    std::deque<pending> filled_;
+    bool writing_{ false };
+    bool stop_{ false };
+
+    // set by the writer, not yet reported, and in total
+    std::atomic<std::uint64_t> lost_{ 0 };
+    std::atomic<std::uint64_t> lost_total_{ 0 };
+    std::atomic<int> error_{ 0 };
+    std::thread writer_;
+  };
+}
@@ -0,0 +1,170 @@
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <filesystem>
+
+#include <spdlog/spdlog.h>
+
+#include "bench.h"
+
+namespace rostrum::bench {
+  namespace {
+    // clock_ns is relative to this point, so values stay small and exact as lua numbers
+    const auto kClockStart = std::chrono::steady_clock::now();
+
+    struct baseline_entry {
+      double median_ns;
+      double mad_ns;
+    };
+
+    std::uint64_t call(lua_State* L, const int index, const std::uint64_t iterations) {
+      const auto begin = clock_ns();
+      for (std::uint64_t i = 0; i < iterations; ++i) {
+        lua_pushvalue(L, index);
+        if (lua_pcall(L, 0, 0, 0) != 0) {
+          std::string error = lua_tostring(L, -1) != nullptr ? lua_tostring(L, -1) : "unknown error";
+          lua_pop(L, 1);
+          throw std::runtime_error("benchmarked function failed: " + error);
+        }
+      }
+      return static_cast<std::uint64_t>(clock_ns() - begin);
+    }
+
+    // samples must be sorted
+    double percentile(const std::vector<double>& samples, const double p) {
+      const auto rank = static_cast<std::size_t>(std::ceil(p * static_cast<double>(std::size(samples))));
+      return samples[(std::max)(rank, std::size_t{ 1 }) - 1];
+    }
+
+    double median(std::vector<double> samples) {
+      std::sort(std::begin(samples), std::end(samples));
+      const auto n = std::size(samples);
+      return n % 2 == 1 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    }
+
+    // baseline file has "name median_ns mad_ns" lines
+    std::optional<baseline_entry> read_baseline(const std::string& path, const std::string& name) {
+      std::ifstream in(path);
+      std::string line;
+      while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string entry_name;
+        baseline_entry entry{};
+        if (fields >> entry_name >> entry.median_ns >> entry.mad_ns && entry_name == name) {
+          return entry;
+        }
+      }
+      return std::nullopt;
+    }
+
+    void write_baseline(const std::string& path, const std::string& name, const baseline_entry& entry) {
+      std::vector<std::string> lines;
+      {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+          std::istringstream fields(line);
+          std::string entry_name;
+          if (fields >> entry_name && entry_name != name) {
+            lines.push_back(line);
+          }
+        }
+      }
+
+      std::ostringstream updated;
+      updated.precision(17);
+      updated << name << ' ' << entry.median_ns << ' ' << entry.mad_ns;
+      lines.push_back(updated.str());
+      std::sort(std::begin(lines), std::end(lines));
+
+      const auto temp = path + ".tmp";
+      {
+        std::ofstream out(temp, std::ios::trunc);
+        if (!out) {
+          throw std::runtime_error("cannot write benchmark baseline '" + path + '\'');
+        }
+        for (const auto& line : lines) {
+          out << line << '\n';
+        }
+      }
+      std::filesystem::rename(temp, path);
+    }
+  }
+
+  std::int64_t clock_ns() noexcept {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now() - kClockStart).count();
+  }
+
+  result run(lua_State* L, int index, const options& opts) {
+    if (opts.repetitions == 0 || opts.min_time <= 0) {
+      throw std::invalid_argument("benchmark repetitions and min_time must be positive");
+    }
+    if (!opts.baseline.empty() && opts.name.empty()) {
+      throw std::invalid_argument("benchmark with baseline needs a name");
+    }
+    if (index < 0) {
+      index = lua_gettop(L) + index + 1;
+    }
+    luaL_checkstack(L, 2, "bench");
+
+    // warmup lets JIT compile traces
+    const auto warmup_ns = static_cast<std::int64_t>(opts.warmup * 1e9);
+    for (const auto begin = clock_ns(); clock_ns() - begin < warmup_ns;) {
+      call(L, index, 1);
+    }
+
+    // scale iterations so a sample is long enough for clock resolution
+    const auto min_ns = static_cast<std::uint64_t>(opts.min_time * 1e9);
+    std::uint64_t iterations = 1;
+    while (call(L, index, iterations) < min_ns) {
+      iterations *= 2;
+    }
+
+    std::vector<double> samples;
+    samples.reserve(opts.repetitions);
+    for (std::size_t i = 0; i < opts.repetitions; ++i) {
+      if (opts.gc) {
+        lua_gc(L, LUA_GCCOLLECT, 0);
+      }
+      samples.push_back(static_cast<double>(call(L, index, iterations)) / static_cast<double>(iterations));
+    }
+    std::sort(std::begin(samples), std::end(samples));
+
+    result r{};
+    r.iterations = iterations;
+    r.repetitions = opts.repetitions;
+    r.median_ns = median(samples);
+    r.p99_ns = percentile(samples, 0.99);
+    r.min_ns = samples.front();
+    for (const auto s : samples) {
+      r.mean_ns += s / static_cast<double>(std::size(samples));
+    }
+    std::vector<double> deviations;
+    deviations.reserve(std::size(samples));
+    for (const auto s : samples) {
+      deviations.push_back(std::abs(s - r.median_ns));
+    }
+    r.mad_ns = median(std::move(deviations));
+
+    if (!opts.baseline.empty()) {
+      if (const auto base = read_baseline(opts.baseline, opts.name)) {
+        r.baseline_ns = base->median_ns;
+        r.change = r.median_ns / base->median_ns - 1;
+        // slowdown must exceed threshold and noise of both runs
+        const auto noise = 3 * (std::max)(r.mad_ns, base->mad_ns);
+        r.regression = *r.change > opts.threshold && r.median_ns - base->median_ns > noise;
+      }
+      if (opts.save) {
+        write_baseline(opts.baseline, opts.name, { r.median_ns, r.mad_ns });
+      }
+    }
+
+    spdlog::debug("benchmark '{}': {} x {} iterations, median {:.1f} ns", opts.name, r.repetitions, r.iterations, r.median_ns);
+    return r;
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <optional>
+
+#include "include/api.hpp"
+
+/*
+ * Microbenchmark harness for lua functions.
+ * Iterations per sample are doubled until a sample takes at least min_time,
+ * then repetitions samples are taken and summarized by robust statistics.
+ */
+namespace rostrum::bench {
+
+  struct options {
+    std::string name;
+    double warmup = 0.1;
+    double min_time = 0.01;
+    std::size_t repetitions = 20;
+    // full gc before every sample. not included in timing
+    bool gc = false;
+
+    // baseline file to compare with and optionally update
+    std::string baseline;
+    bool save = false;
+    // relative slowdown of median which is reported as regression
+    double threshold = 0.05;
+  };
+
+  struct result {
+    std::uint64_t iterations;
+    std::size_t repetitions;
+    // per iteration
+    double median_ns;
+    double p99_ns;
+    double mad_ns;
+    double min_ns;
+    double mean_ns;
+
+    std::optional<double> baseline_ns;
+    // median relative to baseline minus 1
+    std::optional<double> change;
+    bool regression;
+  };
+
+  // nanoseconds of monotonic clock since process start
+  [[nodiscard]]
+  std::int64_t clock_ns() noexcept;
+
+  // benchmark function at @index. throws std::runtime_error if it raises lua error
+  [[nodiscard]]
+  result run(lua_State* L, int index, const options& opts);
+}
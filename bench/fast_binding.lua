@@ -0,0 +1,39 @@
+-- call overhead of fast (unchecked) and safe (sol3 checked) bindings of the same native function
+-- usage: rostrum-host bench/fast_binding.lua [baseline file]
+-- requires host built with ROSTRUM_BENCH defined
+local args = ...
+local core = require(":core")
+core.load_lua_libs(core.lib.string)
+
+if core.bench_bindings == nil then
+  error("core.bench_bindings is only available in hosts built with ROSTRUM_BENCH")
+end
+
+local baseline = args and args[1]
+local fast, safe = core.bench_bindings.fast, core.bench_bindings.safe
+
+local function report(name, fn)
+  local r = core.bench(fn, { name = name, baseline = baseline, save = baseline ~= nil })
+  local change = r.change and string.format(" (%+.1f%%)", r.change * 100) or ""
+  print(string.format("%-24s %8.1f ns  mad %6.1f ns%s", name, r.median_ns, r.mad_ns, change))
+  return r.median_ns
+end
+
+-- 100 calls per iteration so harness overhead does not dominate
+local loop = report("binding.loop", function()
+  local x = 0
+  for i = 1, 100 do x = x + i end
+  return x
+end)
+local fast_ns = report("binding.fast", function()
+  local x = 0
+  for i = 1, 100 do x = fast(x, i) end
+  return x
+end)
+local safe_ns = report("binding.safe", function()
+  local x = 0
+  for i = 1, 100 do x = safe(x, i) end
+  return x
+end)
+
+print(string.format("per call: fast %.1f ns, safe %.1f ns", (fast_ns - loop) / 100, (safe_ns - loop) / 100))
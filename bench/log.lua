@@ -0,0 +1,27 @@
+-- per-call overhead of core.log_*
+-- usage: rostrum-host bench/log.lua [baseline file]
+local args = ...
+local core = require(":core")
+core.load_lua_libs(core.lib.string)
+
+local baseline = args and args[1]
+
+local function report(name, fn)
+  local r = core.bench(fn, { name = name, baseline = baseline, save = baseline ~= nil })
+  local change = r.change and string.format(" (%+.1f%%)", r.change * 100) or ""
+  print(string.format("%-24s %8.1f ns  mad %6.1f ns%s", name, r.median_ns, r.mad_ns, change))
+end
+
+-- message below active level is dropped before any argument conversion
+core.set_log_level("info")
+report("log.filtered", function()
+  core.log_debug("filtered out")
+end)
+
+-- enabled message, call site is looked up once and then served from cache
+report("log.enabled", function()
+  core.log_info("enabled")
+end)
+
+-- empty function for reference of harness overhead
+report("log.baseline", function() end)
@@ -0,0 +1,56 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+/*
+ * Binary log file format.
+ * All integers are written in host byte order.
+ *
+ *   file      := magic record*
+ *   record    := call_site | message
+ *   call_site := u8(1) u32 id u32 length char[length]
+ *   message   := u8(2) i64 timestamp_ns u8 level u32 call_site_id u32 length char[length]
+ *
+ * Call site id 0 is used for messages without lua call site.
+ * Timestamp is nanoseconds since system clock epoch.
+ */
+namespace rostrum::binlog {
+
+  constexpr std::array<char, 8> kMagic = { 'R', 'L', 'O', 'G', 'B', 'I', 'N', '1' };
+
+  constexpr std::uint32_t kNoCallSite = 0;
+
+  enum class record_type : std::uint8_t {
+    call_site = 1,
+    message = 2
+  };
+
+  // spdlog level names
+  constexpr std::array<std::string_view, 7> kLevelNames = { "trace", "debug", "info", "warning", "error", "critical", "off" };
+
+  template <typename Buffer, typename T>
+  void append_pod(Buffer& buffer, const T& value) {
+    const auto bytes = reinterpret_cast<const char*>(&value);
+    buffer.append(bytes, bytes + sizeof(T));
+  }
+
+  template <typename Buffer>
+  void append_call_site(Buffer& buffer, const std::uint32_t id, const std::string_view site) {
+    append_pod(buffer, record_type::call_site);
+    append_pod(buffer, id);
+    append_pod(buffer, static_cast<std::uint32_t>(std::size(site)));
+    buffer.append(std::data(site), std::data(site) + std::size(site));
+  }
+
+  template <typename Buffer>
+  void append_message(Buffer& buffer, const std::int64_t timestamp, const std::uint8_t level, const std::uint32_t site, const std::string_view payload) {
+    append_pod(buffer, record_type::message);
+    append_pod(buffer, timestamp);
+    append_pod(buffer, level);
+    append_pod(buffer, site);
+    append_pod(buffer, static_cast<std::uint32_t>(std::size(payload)));
+    buffer.append(std::data(payload), std::data(payload) + std::size(payload));
+  }
+}
@@ -0,0 +1,145 @@
+#include <new>
+#include <mutex>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+
+#include "budget.h"
+#include "state_alloc.h"
+
+namespace rostrum::budget {
+  namespace {
+    using namespace std::chrono;
+
+    constexpr auto kStateKey = "rostrum.budget";
+    // allocator refuses to grow the heap this far over budget, for code not reaching the hook
+    constexpr std::size_t kMinHeadroom = 1024 * 1024;
+
+    std::mutex defaults_mutex;
+    limits defaults;
+
+    // userdata kept in registry
+    struct state_budget {
+      limits max;
+      std::uint64_t instructions;
+      steady_clock::time_point start;
+    };
+
+    state_budget* get_state(lua_State* L) {
+      lua_getfield(L, LUA_REGISTRYINDEX, kStateKey);
+      const auto b = static_cast<state_budget*>(lua_touserdata(L, -1));
+      lua_pop(L, 1);
+      return b;
+    }
+
+    void hook(lua_State* L, lua_Debug*) {
+      const auto b = get_state(L);
+      const auto a = alloc::get(L);
+      if (b == nullptr || a == nullptr) {
+        return;
+      }
+
+      b->instructions += kHookInterval;
+      const auto elapsed = duration_cast<milliseconds>(steady_clock::now() - b->start);
+
+      const char* exceeded = nullptr;
+      if (b->max.instructions != 0 && b->instructions > b->max.instructions) {
+        exceeded = "instruction";
+      }
+      else if (b->max.time.count() != 0 && elapsed > b->max.time) {
+        exceeded = "time";
+      }
+      else if (b->max.heap_bytes != 0 && a->bytes > b->max.heap_bytes) {
+        exceeded = "heap";
+      }
+      if (exceeded == nullptr) {
+        return;
+      }
+
+      // lua_pushfstring has no 64 bit integer formats
+      char message[160];
+      std::snprintf(message, sizeof(message), "%s budget exceeded: %llu instructions, %lld ms, %llu heap bytes", exceeded,
+        static_cast<unsigned long long>(b->instructions), static_cast<long long>(elapsed.count()), static_cast<unsigned long long>(a->bytes));
+      luaL_error(L, "%s", message);
+    }
+
+    // instruction and time limits are checked by the hook only, which compiled traces never call
+    bool needs_interpreter(const limits& l) {
+      return l.instructions != 0 || l.time.count() != 0;
+    }
+
+    int jit_on_refused(lua_State* L) {
+      return luaL_error(L, "JIT compiler cannot be enabled while instruction or time budget is set");
+    }
+  }
+
+  void set_defaults(const limits& l) {
+    std::scoped_lock lock(defaults_mutex);
+    defaults = l;
+  }
+
+  limits get_defaults() {
+    std::scoped_lock lock(defaults_mutex);
+    return defaults;
+  }
+
+  void install(lua_State* L) {
+    const auto a = alloc::get(L);
+    if (a == nullptr) {
+      throw std::runtime_error("budget requires accounting allocator");
+    }
+
+    const auto l = get_defaults();
+    const auto b = static_cast<state_budget*>(lua_newuserdata(L, sizeof(state_budget)));
+    new (b) state_budget{ l, 0, steady_clock::now() };
+    lua_setfield(L, LUA_REGISTRYINDEX, kStateKey);
+
+    if (l.heap_bytes != 0) {
+      a->hard_limit = l.heap_bytes + (std::max)(l.heap_bytes / 4, kMinHeadroom);
+    }
+    if (l.instructions != 0 || l.time.count() != 0 || l.heap_bytes != 0) {
+      lua_sethook(L, hook, LUA_MASKCOUNT, kHookInterval);
+    }
+    if (needs_interpreter(l)) {
+      luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+    }
+  }
+
+  void restrict_jit(lua_State* L) {
+    const auto b = get_state(L);
+    if (b == nullptr || !needs_interpreter(b->max)) {
+      return;
+    }
+    lua_getglobal(L, "jit");
+    if (lua_istable(L, -1)) {
+      lua_pushcfunction(L, jit_on_refused);
+      lua_setfield(L, -2, "on");
+    }
+    lua_pop(L, 1);
+  }
+
+  void reset(lua_State* L) {
+    if (const auto b = get_state(L)) {
+      b->instructions = 0;
+      b->start = steady_clock::now();
+    }
+  }
+
+  usage get_usage(lua_State* L) {
+    usage result{};
+    if (const auto b = get_state(L)) {
+      result.instructions = b->instructions;
+      result.time = duration_cast<milliseconds>(steady_clock::now() - b->start);
+    }
+    if (const auto a = alloc::get(L)) {
+      result.heap_bytes = a->bytes;
+      result.peak_heap_bytes = a->peak;
+    }
+    return result;
+  }
+
+  limits get_limits(lua_State* L) {
+    const auto b = get_state(L);
+    return b != nullptr ? b->max : limits{};
+  }
+}
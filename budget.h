@@ -0,0 +1,54 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+#include "include/api.hpp"
+
+/*
+ * Coarse per-state execution budgets. 0 is unlimited.
+ * Instructions and wall time are checked by a count hook every kHookInterval instructions,
+ * heap bytes by the same hook and, with headroom, by the state allocator.
+ * JIT compiled code never calls hooks, so the JIT compiler is off in states with instruction or time limit.
+ * Heap limit alone keeps the JIT compiler on, the allocator enforces it in compiled code too.
+ */
+namespace rostrum::budget {
+
+  constexpr int kHookInterval = 10000;
+
+  struct limits {
+    std::uint64_t instructions = 0;
+    std::chrono::milliseconds time{ 0 };
+    std::size_t heap_bytes = 0;
+  };
+
+  struct usage {
+    // counted in kHookInterval steps, only if any limit is set
+    std::uint64_t instructions;
+    std::chrono::milliseconds time;
+    std::size_t heap_bytes;
+    std::size_t peak_heap_bytes;
+  };
+
+  // limits of states initialized afterwards
+  void set_defaults(const limits& l);
+
+  [[nodiscard]]
+  limits get_defaults();
+
+  // requires accounting allocator (alloc::install)
+  void install(lua_State* L);
+
+  // keep jit.on from re-enabling the compiler in a state with instruction or time limit. called when jit lib is opened
+  void restrict_jit(lua_State* L);
+
+  // restart instruction and time accounting, e.g. for state initialized ahead of its script
+  void reset(lua_State* L);
+
+  [[nodiscard]]
+  usage get_usage(lua_State* L);
+
+  // limits the state was initialized with
+  [[nodiscard]]
+  limits get_limits(lua_State* L);
+}
@@ -0,0 +1,220 @@
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <xxhash.h>
+
+#include <spdlog/spdlog.h>
+
+#include "bytecode_cache.h"
+#include "marshal.h"
+#include "mapped_file.h"
+
+namespace rostrum {
+  namespace {
+    namespace fs = std::filesystem;
+
+    constexpr std::uintmax_t kDefaultLimit = 64 * 1024 * 1024;
+    constexpr auto kExtension = ".ljbc";
+
+    // bytecode is only compatible with the same LuaJIT build
+    constexpr XXH64_hash_t kSeed = (static_cast<XXH64_hash_t>(LUAJIT_VERSION_NUM) << 8) | sizeof(void*);
+
+    std::string make_key(const std::string& chunkname, const XXH128_hash_t& source_hash) {
+      XXH3_state_t state;
+      XXH3_128bits_reset_withSeed(&state, kSeed);
+      XXH3_128bits_update(&state, chunkname.c_str(), std::size(chunkname) + 1);
+      XXH3_128bits_update(&state, &source_hash, sizeof(source_hash));
+      const auto hash = XXH3_128bits_digest(&state);
+      return fmt::format("{:016x}{:016x}", hash.high64, hash.low64);
+    }
+
+    // per-user location, never shared with other accounts
+    fs::path cache_dir() {
+#ifdef _WIN32
+      if (const auto* local = std::getenv("LOCALAPPDATA"); local && *local) {
+        return fs::path(local) / "rostrum" / "bytecode";
+      }
+#else
+      if (const auto* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+        return fs::path(xdg) / "rostrum" / "bytecode";
+      }
+      if (const auto* home = std::getenv("HOME"); home && *home) {
+        return fs::path(home) / ".cache" / "rostrum" / "bytecode";
+      }
+#endif
+      return fs::temp_directory_path() / "rostrum-bytecode";
+    }
+
+    // bytecode is not verified by LuaJIT, so only load what nobody else could have written
+    bool trusted(const fs::path& path, const bool directory) {
+#ifdef _WIN32
+      std::error_code ec;
+      const auto status = fs::symlink_status(path, ec);
+      return directory ? fs::is_directory(status) : fs::is_regular_file(status);
+#else
+      struct stat st {};
+      if (::lstat(path.c_str(), &st) != 0) {
+        return false;
+      }
+      if (directory ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode)) {
+        return false;
+      }
+      return st.st_uid == ::geteuid() && (st.st_mode & (directory ? 077 : 022)) == 0;
+#endif
+    }
+  }
+
+  bytecode_cache::bytecode_cache()
+    : dir_(cache_dir()), limit_(kDefaultLimit) {
+  }
+
+  bytecode_cache& bytecode_cache::get_instance() {
+    static bytecode_cache instance;
+    return instance;
+  }
+
+  sol::load_result bytecode_cache::load(sol::state_view& lua, const std::string_view source, const std::string& chunkname, const XXH128_hash_t& hash) {
+    if (!enabled()) {
+      return lua.load(source, chunkname, sol::load_mode::text);
+    }
+
+    const auto path = dir_ / (make_key(chunkname, hash) + kExtension);
+
+    if (std::error_code ec; fs::exists(path, ec) && trusted(dir_, true)) {
+      if (!trusted(path, false)) {
+        spdlog::warn("ignoring bytecode cache entry '{}' not owned by current user", path.string());
+        ++misses_;
+        return lua.load(source, chunkname, sol::load_mode::text);
+      }
+
+      {
+        const mapped_file bytecode(path.string());
+        auto result = lua.load(bytecode.view(), chunkname, sol::load_mode::binary);
+        if (result.valid()) {
+          ++hits_;
+          // keep recently used entries from eviction
+          fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+          return result;
+        }
+      }
+
+      spdlog::warn("dropping invalid bytecode cache entry '{}'", path.string());
+      fs::remove(path, ec);
+    }
+
+    ++misses_;
+    auto result = lua.load(source, chunkname, sol::load_mode::text);
+    if (result.valid()) {
+      try {
+        store(path, marshal::dump_function(lua.lua_state(), result.stack_index()));
+      }
+      catch (const std::exception& e) {
+        spdlog::warn("failed to store bytecode of '{}': {}", chunkname, e.what());
+      }
+    }
+    return result;
+  }
+
+  bytecode_cache::stats bytecode_cache::get_stats() {
+    std::scoped_lock lock(mutex_);
+    return { hits_, misses_, stores_, evictions_, size_.value_or(0) };
+  }
+
+  void bytecode_cache::set_limit(const std::uintmax_t limit) {
+    limit_ = limit;
+    std::scoped_lock lock(mutex_);
+    evict();
+  }
+
+  void bytecode_cache::store(const fs::path& path, const std::string& bytecode) {
+    std::scoped_lock lock(mutex_);
+
+    prepare_dir();
+
+    // write to temp file first so concurrent hosts never load partial bytecode
+    auto temp_path = path;
+    temp_path += ".tmp";
+    {
+      std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+      if (!out || !out.write(std::data(bytecode), std::size(bytecode))) {
+        throw std::runtime_error("cannot write '" + temp_path.string() + "'");
+      }
+    }
+    fs::permissions(temp_path, fs::perms::owner_read | fs::perms::owner_write);
+    fs::rename(temp_path, path);
+
+    ++stores_;
+    if (size_) {
+      *size_ += std::size(bytecode);
+    }
+    evict();
+  }
+
+  void bytecode_cache::prepare_dir() {
+    if (!fs::exists(dir_)) {
+      fs::create_directories(dir_.parent_path());
+#ifdef _WIN32
+      fs::create_directory(dir_);
+#else
+      if (::mkdir(dir_.c_str(), 0700) != 0 && errno != EEXIST) {
+        throw std::runtime_error("cannot create '" + dir_.string() + "'");
+      }
+#endif
+    }
+
+    if (!trusted(dir_, true)) {
+      throw std::runtime_error("'" + dir_.string() + "' must be a directory owned by current user and not accessible by others");
+    }
+  }
+
+  void bytecode_cache::evict() {
+    std::error_code ec;
+    if (!fs::exists(dir_, ec) || !trusted(dir_, true)) {
+      return;
+    }
+
+    // size is calculated once, then tracked on store
+    if (!size_) {
+      size_ = 0;
+      for (const auto& entry : fs::directory_iterator(dir_, ec)) {
+        *size_ += entry.file_size(ec);
+      }
+    }
+
+    if (*size_ <= limit_) {
+      return;
+    }
+
+    std::vector<fs::directory_entry> entries;
+    for (const auto& entry : fs::directory_iterator(dir_, ec)) {
+      if (entry.path().extension() == kExtension) {
+        entries.push_back(entry);
+      }
+    }
+    std::sort(std::begin(entries), std::end(entries), [](const auto& a, const auto& b) {
+      return a.last_write_time() < b.last_write_time();
+    });
+
+    // evict oldest entries until cache is reduced to 3/4 of the limit
+    const auto target = limit_ / 4 * 3;
+    for (const auto& entry : entries) {
+      if (*size_ <= target) {
+        break;
+      }
+      const auto size = entry.file_size(ec);
+      if (fs::remove(entry.path(), ec)) {
+        *size_ -= (std::min)(*size_, size);
+        ++evictions_;
+      }
+    }
+  }
+}
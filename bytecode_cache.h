@@ -0,0 +1,66 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <filesystem>
+
+#include <xxhash.h>
+
+#include "include/api.hpp"
+
+namespace rostrum {
+  /*
+   * On-disk cache of compiled lua chunks.
+   * Entries are keyed by chunkname, XXH3-128 of source and LuaJIT version.
+   * Least recently used entries are evicted once cache grows over the limit.
+   * Cache lives in a per-user 0700 directory. Entries are loaded only if the
+   * directory and the entry are owned by current user and not writable by others.
+   */
+  class bytecode_cache final {
+  public:
+    struct stats {
+      std::uint64_t hits;
+      std::uint64_t misses;
+      std::uint64_t stores;
+      std::uint64_t evictions;
+      std::uintmax_t size;
+    };
+
+  private:
+    bytecode_cache();
+
+  public:
+    static bytecode_cache& get_instance();
+
+    // load chunk from cache. parse @source and cache it on miss. @hash is XXH3-128 of @source
+    [[nodiscard]] sol::load_result load(sol::state_view& lua, std::string_view source, const std::string& chunkname, const XXH128_hash_t& hash);
+
+    [[nodiscard]] bool enabled() const noexcept {
+      return limit_ != 0;
+    }
+
+    [[nodiscard]] stats get_stats();
+
+    // cache size limit in bytes. 0 disables cache
+    void set_limit(std::uintmax_t limit);
+
+  private:
+    void store(const std::filesystem::path& path, const std::string& bytecode);
+    void prepare_dir();
+    void evict();
+
+    const std::filesystem::path dir_;
+    std::atomic<std::uintmax_t> limit_;
+
+    std::mutex mutex_;
+    std::optional<std::uintmax_t> size_;
+
+    std::atomic<std::uint64_t> hits_{ 0 };
+    std::atomic<std::uint64_t> misses_{ 0 };
+    std::atomic<std::uint64_t> stores_{ 0 };
+    std::atomic<std::uint64_t> evictions_{ 0 };
+  };
+}
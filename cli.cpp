@@ -0,0 +1,146 @@
+#include <string_view>
+#include <stdexcept>
+#include <charconv>
+
+#include "cli.h"
+
+namespace rostrum::cli {
+  namespace {
+    std::size_t to_size(const std::string_view name, const std::string_view value) {
+      std::size_t result{};
+      const auto [end, ec] = std::from_chars(std::data(value), std::data(value) + std::size(value), result);
+      if (ec != std::errc{} || end != std::data(value) + std::size(value) || result == 0) {
+        throw std::invalid_argument("option " + std::string(name) + " expects positive integer");
+      }
+      return result;
+    }
+
+    std::string to_path(const std::string_view name, const std::string_view value) {
+      if (value.empty()) {
+        throw std::invalid_argument("option " + std::string(name) + " expects path");
+      }
+      return std::string(value);
+    }
+  }
+
+  const char kUsage[] =
+    "Usage: rostrum-host [options] <script.rlua> [args]\n"
+    "       rostrum-host --serve=SOCKET [options]\n"
+    "       rostrum-host --batch=MANIFEST [options]\n"
+    "Options:\n"
+    "  --log-queue-size=N      async log queue size (default 8192)\n"
+    "  --log-threads=N         async log worker threads (default 1)\n"
+    "  --log-overflow=POLICY   block | drop_oldest | drop_newest (default block)\n"
+    "  --log-format=FORMAT     text | binary log file (default text)\n"
+    "  --log-writer=WRITER     direct | batched log file writes (default direct)\n"
+    "  --watch-modules         reload changed rostrum modules while running\n"
+    "  --metrics[=FILE]        count native calls. written as json to FILE at exit\n"
+    "  --memprofile=FILE       sample lua allocations of the script. written as collapsed stacks to FILE at exit\n"
+    "  --memprofile-interval=N sample one allocation every N bytes (default 524288)\n"
+    "  --max-instructions=N    stop scripts after about N vm instructions\n"
+    "  --max-time=MS           stop scripts running longer than MS milliseconds\n"
+    "  --max-heap=BYTES        stop scripts growing lua heap over BYTES\n"
+    "  --gc-pause=N            collector pause in percent of heap after last cycle\n"
+    "  --gc-stepmul=N          collector step multiplier in percent\n"
+    "  --serve=SOCKET          keep modules loaded and run scripts of clients connecting to SOCKET\n"
+    "  --serve-workers=N       scripts run concurrently by server (default hardware threads)\n"
+    "  --connect=SOCKET        run script on server listening on SOCKET\n"
+    "  --batch=MANIFEST        run jobs of MANIFEST, one script and args per line or JSON object\n"
+    "  --batch-threads=N       jobs run concurrently in batch mode (default hardware threads)\n"
+    "  --batch-logs=DIR        write output and logs of every batch job to DIR/job-N.log\n";
+
+  options parse(const int argc, const char* const argv[]) {
+    options result;
+
+    auto i = 1;
+    for (; i < argc; ++i) {
+      const std::string_view arg = argv[i];
+      if (arg.substr(0, 2) != "--") {
+        break;
+      }
+
+      const auto eq = arg.find('=');
+      const auto name = arg.substr(0, eq);
+      const auto value = eq == std::string_view::npos ? std::string_view{} : arg.substr(eq + 1);
+
+      if (name == "--log-queue-size") {
+        result.logging.queue_size = to_size(name, value);
+      }
+      else if (name == "--log-threads") {
+        result.logging.threads = to_size(name, value);
+      }
+      else if (name == "--log-overflow") {
+        result.logging.overflow = logging::parse_overflow_policy(value);
+      }
+      else if (name == "--log-format") {
+        result.logging.format = logging::parse_log_format(value);
+      }
+      else if (name == "--log-writer") {
+        result.logging.writer = logging::parse_log_writer(value);
+      }
+      else if (name == "--watch-modules") {
+        result.watch_modules = true;
+      }
+      else if (name == "--metrics") {
+        result.metrics = true;
+        result.metrics_path = value;
+      }
+      else if (name == "--memprofile") {
+        result.memprofile_path = to_path(name, value);
+      }
+      else if (name == "--memprofile-interval") {
+        result.memprofile_interval = to_size(name, value);
+      }
+      else if (name == "--max-instructions") {
+        result.budget.instructions = to_size(name, value);
+      }
+      else if (name == "--max-time") {
+        result.budget.time = std::chrono::milliseconds(to_size(name, value));
+      }
+      else if (name == "--max-heap") {
+        result.budget.heap_bytes = to_size(name, value);
+      }
+      else if (name == "--gc-pause") {
+        result.gc.pause = static_cast<int>(to_size(name, value));
+      }
+      else if (name == "--gc-stepmul") {
+        result.gc.stepmul = static_cast<int>(to_size(name, value));
+      }
+      else if (name == "--serve") {
+        result.serve_socket = to_path(name, value);
+      }
+      else if (name == "--serve-workers") {
+        result.serve_workers = to_size(name, value);
+      }
+      else if (name == "--connect") {
+        result.connect_socket = to_path(name, value);
+      }
+      else if (name == "--batch") {
+        result.batch_manifest = to_path(name, value);
+      }
+      else if (name == "--batch-threads") {
+        result.batch_threads = to_size(name, value);
+      }
+      else if (name == "--batch-logs") {
+        result.batch_log_dir = to_path(name, value);
+      }
+      else {
+        throw std::invalid_argument("unknown option " + std::string(name));
+      }
+    }
+
+    if (i < argc) {
+      result.script = argv[i++];
+    }
+    for (; i < argc; ++i) {
+      result.script_args.emplace_back(argv[i]);
+    }
+
+    const auto modes = !result.serve_socket.empty() + !result.connect_socket.empty() + !result.batch_manifest.empty();
+    if (modes > 1) {
+      throw std::invalid_argument("options --serve, --connect and --batch are exclusive");
+    }
+
+    return result;
+  }
+}
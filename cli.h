@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "logging.h"
+#include "budget.h"
+#include "gc_telemetry.h"
+
+namespace rostrum::cli {
+
+  struct options {
+    logging::options logging;
+    // limits of every script state
+    budget::limits budget;
+    gc::tuning gc;
+    bool watch_modules = false;
+    // metrics are written as json at exit if not empty
+    bool metrics = false;
+    std::string metrics_path;
+    // allocation sampling of the script state, written at exit if not empty
+    std::string memprofile_path;
+    std::size_t memprofile_interval = 512 * 1024;
+    // warm daemon listening on the socket, or client of one
+    std::string serve_socket;
+    std::size_t serve_workers = 0;
+    std::string connect_socket;
+    // jobs manifest run instead of a single script
+    std::string batch_manifest;
+    std::size_t batch_threads = 0;
+    std::string batch_log_dir;
+
+    std::string script;
+    std::vector<std::string> script_args;
+  };
+
+  // host options come before script name. throws std::invalid_argument
+  [[nodiscard]]
+  options parse(int argc, const char* const argv[]);
+
+  extern const char kUsage[];
+}
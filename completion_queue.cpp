@@ -0,0 +1,135 @@
+#include <new>
+#include <string>
+#include <stdexcept>
+
+#include "completion_queue.h"
+
+namespace rostrum {
+  namespace {
+    static_assert((completion_queue::kCapacity & (completion_queue::kCapacity - 1)) == 0, "capacity must be power of two");
+    constexpr auto kMask = completion_queue::kCapacity - 1;
+
+    // userdata kept in registry under api::kHostServices
+    struct state_services {
+      api::host_services services;
+      // queue is over-aligned, userdata memory is not
+      std::unique_ptr<completion_queue> queue;
+    };
+
+    bool post(api::completion_queue* queue, const int callback, api::buffer* payload) noexcept {
+      auto& q = *reinterpret_cast<completion_queue*>(queue);
+      api::buffer empty;
+      return q.push(callback, std::move(payload != nullptr ? *payload : empty));
+    }
+
+    int gc(lua_State* L) {
+      static_cast<state_services*>(lua_touserdata(L, 1))->~state_services();
+      return 0;
+    }
+  }
+
+  completion_queue::completion_queue() : cells_(std::make_unique<cell[]>(kCapacity)) {
+    for (std::size_t i = 0; i < kCapacity; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // bounded queue by D. Vyukov: cell sequence tells whether it is free for position or holds its value
+  bool completion_queue::push(const int callback, api::buffer&& payload) noexcept {
+    auto pos = tail_.load(std::memory_order_relaxed);
+    cell* c;
+    while (true) {
+      c = &cells_[pos & kMask];
+      const auto sequence = c->sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (diff < 0) {
+        return false;
+      }
+      else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+
+    c->callback = callback;
+    c->payload = std::move(payload);
+    c->sequence.store(pos + 1, std::memory_order_seq_cst);
+
+    if (waiting_.load(std::memory_order_seq_cst)) {
+      std::scoped_lock lock(mutex_);
+      cv_.notify_one();
+    }
+    return true;
+  }
+
+  bool completion_queue::pop(int& callback, api::buffer& payload) noexcept {
+    auto& c = cells_[head_ & kMask];
+    if (c.sequence.load(std::memory_order_acquire) != head_ + 1) {
+      return false;
+    }
+
+    callback = c.callback;
+    payload = std::move(c.payload);
+    c.sequence.store(head_ + kCapacity, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+  bool completion_queue::wait(const std::chrono::milliseconds timeout) {
+    const auto ready = [this] {
+      return cells_[head_ & kMask].sequence.load(std::memory_order_seq_cst) == head_ + 1;
+    };
+
+    std::unique_lock lock(mutex_);
+    waiting_.store(true, std::memory_order_seq_cst);
+    const auto result = cv_.wait_for(lock, timeout, ready);
+    waiting_.store(false, std::memory_order_relaxed);
+    return result;
+  }
+
+  void completion_queue::install(lua_State* L) {
+    auto queue = std::make_unique<completion_queue>();
+    new (lua_newuserdata(L, sizeof(state_services))) state_services{
+      { api::kRostrumApiVersion, reinterpret_cast<api::completion_queue*>(queue.get()), &post },
+      std::move(queue)
+    };
+
+    lua_newtable(L);
+    lua_pushcfunction(L, gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, api::kHostServices);
+  }
+
+  completion_queue& completion_queue::queue_of(lua_State* L) {
+    const auto services = api::get_services(L);
+    if (services == nullptr) {
+      throw std::runtime_error("lua state has no host services");
+    }
+    return *reinterpret_cast<completion_queue*>(services->queue);
+  }
+
+  std::size_t completion_queue::poll(lua_State* L, const std::size_t max) {
+    auto& queue = queue_of(L);
+
+    std::size_t delivered = 0;
+    int callback;
+    api::buffer payload;
+    while (delivered < max && queue.pop(callback, payload)) {
+      ++delivered;
+      lua_rawgeti(L, LUA_REGISTRYINDEX, callback);
+      luaL_unref(L, LUA_REGISTRYINDEX, callback);
+      api::push_buffer(L, std::move(payload));
+      if (lua_pcall(L, 1, 0, 0) != 0) {
+        std::string error = lua_tostring(L, -1) != nullptr ? lua_tostring(L, -1) : "unknown error";
+        lua_pop(L, 1);
+        throw std::runtime_error("completion callback failed: " + error);
+      }
+    }
+    return delivered;
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstddef>
+#include <condition_variable>
+
+#include "include/services.hpp"
+
+namespace rostrum {
+  /*
+   * Bounded lock-free multi-producer single-consumer queue of completions posted by module threads.
+   * One queue per lua state; consumed on the lua thread only.
+   */
+  class completion_queue final {
+  public:
+    static constexpr std::size_t kCapacity = 4096;
+
+    completion_queue();
+
+    completion_queue(const completion_queue&) = delete;
+    completion_queue& operator= (const completion_queue&) = delete;
+
+    // any thread. @payload is moved from on success
+    bool push(int callback, api::buffer&& payload) noexcept;
+
+    // consumer only
+    bool pop(int& callback, api::buffer& payload) noexcept;
+
+    // consumer only. returns false on timeout
+    bool wait(std::chrono::milliseconds timeout);
+
+    // create queue and host services for the state
+    static void install(lua_State* L);
+
+    // queue of a state with host services. throws otherwise
+    static completion_queue& queue_of(lua_State* L);
+
+    // call callbacks of up to @max completions. returns number of delivered completions
+    static std::size_t poll(lua_State* L, std::size_t max);
+
+  private:
+    struct cell {
+      std::atomic<std::size_t> sequence;
+      int callback;
+      api::buffer payload;
+    };
+
+    std::unique_ptr<cell[]> cells_;
+    alignas(64) std::atomic<std::size_t> tail_{ 0 };
+    alignas(64) std::size_t head_{ 0 };
+
+    // producers take the mutex only if consumer sleeps
+    std::atomic<bool> waiting_{ false };
+    std::mutex mutex_;
+    std::condition_variable cv_;
+  };
+}
@@ -1,16 +1,35 @@
 #include <fstream>
 #include <string>
+#include <vector>
 #include <stdexcept>
 #include <chrono>
 #include <filesystem>
-
-#include <xxhash.h>
+#include <unordered_map>
+#include <algorithm>
+#include <memory>
+#include <array>
+#include <cstdio>
+#include <cstring>
 
 #include "manager.h"
 #include "core_module.h"
 #include "sol_check.h"
 #include "logging.h"
 #include "sysinfo.h"
+#include "worker_pool.h"
+#include "bytecode_cache.h"
+#include "script_loader.h"
+#include "profiler.h"
+#include "memprofile.h"
+#include "script_runner.h"
+#include "metrics.h"
+#include "bench.h"
+#include "lua_buffer.h"
+#include "event_loop.h"
+#include "completion_queue.h"
+#include "msgpack.h"
+#include "budget.h"
+#include "gc_telemetry.h"
 
 namespace rostrum {
   namespace {
@@ -23,6 +42,13 @@ namespace rostrum {
       return span.count();
     }
 
+#ifdef ROSTRUM_BENCH
+    // bound through both fast and safe path to compare binding overhead. only in bench builds
+    double bench_add(const double a, const double b) {
+      return a + b;
+    }
+#endif
+
     auto load_lua_libs(const sol::variadic_args va) {
       auto&& state = va.lua_state();
       for (const auto& v : va) {
@@ -33,35 +59,213 @@ namespace rostrum {
     auto load_file_whash(const sol::this_state& state, const char * const filename) {
       sol::state_view lua = state;
 
-      std::ifstream in(filename);
-      if (!in) {
-        throw std::runtime_error(std::string(filename) + " not found");
+      XXH128_hash_t hash;
+      const auto script = sol_check(load_script(lua, filename, hash));
+      const auto f = script.get<sol::protected_function>();
+
+      return std::make_tuple(f, to_hex(hash));
+    }
+
+    auto get_bytecode_cache_stats(const sol::this_state& state) {
+      const auto stats = bytecode_cache::get_instance().get_stats();
+      return sol::state_view(state).create_table_with(
+        "hits", stats.hits,
+        "misses", stats.misses,
+        "stores", stats.stores,
+        "evictions", stats.evictions,
+        "size", stats.size);
+    }
+
+    // lua function or source chunk as code runnable by worker states
+    std::string to_worker_code(lua_State* L, const sol::object& f) {
+      if (f.get_type() == sol::type::string) {
+        return f.as<std::string>();
       }
-      const std::string buffer((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
 
-      const auto script = sol_check(lua.load(buffer, std::string("@") + filename));
-      const auto f = script.get<sol::protected_function>();
-      const auto hash = XXH32(buffer.c_str(), std::size(buffer), 0);
+      f.push(L);
+      try {
+        auto bytecode = marshal::dump_function(L, -1);
+        lua_pop(L, 1);
+        return bytecode;
+      }
+      catch (...) {
+        lua_pop(L, 1);
+        throw;
+      }
+    }
+
+    auto submit(const sol::this_state& state, const sol::object& f, const sol::variadic_args va) {
+      lua_State* L = state;
+      auto args = marshal::from_stack(L, va.stack_index(), static_cast<int>(va.size()));
+      return worker_pool::get_instance().submit(to_worker_code(L, f), "=worker", std::move(args));
+    }
+
+    auto wait(const sol::this_state& state, const worker_pool::ticket& ticket) {
+      lua_State* L = state;
+      const auto& result = worker_pool::get_instance().wait(ticket);
+      if (!result.ok) {
+        throw std::runtime_error(result.error);
+      }
+
+      const auto n = marshal::push(L, result.values);
+      sol::variadic_results results;
+      for (auto i = n; i > 0; --i) {
+        results.push_back(sol::object(L, -i));
+      }
+      lua_pop(L, n);
+      return results;
+    }
 
-      return std::make_tuple(f, hash);
+    // deliver module completions. waits up to @timeout seconds (forever if nil) for the first one
+    std::size_t wait_completions(const sol::this_state& state, const sol::optional<double> timeout) {
+      lua_State* L = state;
+      if (completion_queue::poll(L, 1) == 1) {
+        return 1 + completion_queue::poll(L, completion_queue::kCapacity);
+      }
+
+      const auto deadline = timeout ? steady_clock::now() + duration_cast<steady_clock::duration>(duration<double>(*timeout)) : steady_clock::time_point::max();
+      auto& queue = completion_queue::queue_of(L);
+      // rounded up, so the last fraction of a millisecond is waited for too
+      while (!queue.wait(timeout ? ceil<milliseconds>(deadline - steady_clock::now()) : seconds(1))) {
+        if (steady_clock::now() >= deadline) {
+          return 0;
+        }
+      }
+      return completion_queue::poll(L, completion_queue::kCapacity);
+    }
+
+    // call @f for every item of @items on worker states. returns table of first results
+    auto parallel_map(const sol::this_state& state, const sol::object& f, const sol::table& items) {
+      lua_State* L = state;
+      auto& pool = worker_pool::get_instance();
+      const auto code = to_worker_code(L, f);
+
+      const auto n = std::size(items);
+      std::vector<worker_pool::ticket> tickets;
+      tickets.reserve(n);
+      for (std::size_t i = 1; i <= n; ++i) {
+        items.push();
+        lua_rawgeti(L, -1, static_cast<int>(i));
+        lua_pushnumber(L, static_cast<lua_Number>(i));
+        auto args = marshal::from_stack(L, -2, 2);
+        lua_pop(L, 3);
+        tickets.push_back(pool.submit(code, "=worker", std::move(args)));
+      }
+
+      auto results = sol::state_view(L).create_table(static_cast<int>(n), 0);
+      results.push();
+      for (std::size_t i = 0; i < n; ++i) {
+        const auto& result = pool.wait(tickets[i]);
+        if (!result.ok) {
+          lua_pop(L, 1);
+          throw std::runtime_error(fmt::format("parallel_map: item {} failed: {}", i + 1, result.error));
+        }
+        if (result.values.empty()) {
+          continue;
+        }
+        marshal::push(L, result.values.front());
+        lua_rawseti(L, -2, static_cast<int>(i + 1));
+      }
+      lua_pop(L, 1);
+      return results;
     }
   }
 
-  void log_with_info(const sol::this_state& state, void(*logf)(const std::string&), const std::string& msg) {
-    static lua_Debug dbg;
-    assert(lua_getstack(state, 1, &dbg));
-    assert(lua_getinfo(state, "nSl", &dbg));
+  namespace {
+    // interned source strings are freed with their chunks and another chunk may get the same address,
+    // so sources are not keyed by address alone
+    struct call_site_key {
+      XXH64_hash_t source;
+      int linedefined;
+      int currentline;
+
+      bool operator== (const call_site_key& other) const noexcept {
+        return source == other.source && linedefined == other.linedefined && currentline == other.currentline;
+      }
+    };
+
+    struct call_site_hash {
+      std::size_t operator() (const call_site_key& key) const noexcept {
+        return static_cast<std::size_t>(key.source) ^ (static_cast<std::size_t>(key.linedefined) << 16) ^ static_cast<std::size_t>(key.currentline);
+      }
+    };
+
+    // file chunks ("@path", "=name") are keyed by name. source of a string chunk is the whole chunk,
+    // so it is keyed by address and its short form, which is bounded
+    XXH64_hash_t source_key(const lua_Debug& dbg) {
+      if (dbg.source[0] == '@' || dbg.source[0] == '=') {
+        return XXH3_64bits(dbg.source, std::strlen(dbg.source));
+      }
+      return XXH3_64bits_withSeed(dbg.short_src, std::strlen(dbg.short_src), reinterpret_cast<std::uintptr_t>(dbg.source));
+    }
+
+    struct call_site {
+      // interned "src:name:line"
+      const char* site;
+      int line;
+    };
+
+    // call site of the calling lua function.
+    // function name lookup is expensive so it is done once per call site
+    call_site get_call_site(lua_State* L) {
+      constexpr std::size_t kMaxSites = 4096;
+      thread_local std::unordered_map<call_site_key, const char*, call_site_hash> sites;
+
+      // skip native frames between lua caller and log function, e.g. metrics wrapper
+      lua_Debug dbg;
+      for (auto level = 1;; ++level) {
+        if (lua_getstack(L, level, &dbg) == 0 || lua_getinfo(L, "Sl", &dbg) == 0) {
+          return { nullptr, 0 };
+        }
+        if (std::strcmp(dbg.what, "C") != 0) {
+          break;
+        }
+      }
+
+      const call_site_key key{ source_key(dbg), dbg.linedefined, dbg.currentline };
+      if (const auto it = sites.find(key); it != std::end(sites)) {
+        return { it->second, dbg.currentline };
+      }
+
+      if (std::size(sites) == kMaxSites) {
+        sites.clear();
+      }
+      lua_getinfo(L, "n", &dbg);
+      const auto site = logging::detail::intern_call_site(fmt::format("{}:{}:{}", dbg.short_src, dbg.name ? dbg.name : "?", dbg.currentline));
+      sites.emplace(key, site);
+      return { site, dbg.currentline };
+    }
+
+    // raw lua function to skip argument conversion for filtered out messages
+    template <spdlog::level::level_enum Level>
+    int log_at(lua_State* L) {
+      auto* logger = spdlog::default_logger_raw();
+      if (!logger->should_log(Level)) {
+        return 0;
+      }
 
-    // using custom formatter flag is impossible/too heavy with async logger
-    logf(fmt::format("[{}:{}:{}] {}", dbg.short_src, dbg.name, dbg.currentline, msg));
+      std::size_t len;
+      const auto msg = luaL_checklstring(L, 1, &len);
+      const auto [site, line] = get_call_site(L);
+
+      // call site is passed as source location so sinks can store it apart from the message.
+      // source location with line 0 is treated as empty
+      const spdlog::source_loc location = site ? spdlog::source_loc{ site, (std::max)(line, 1), "" } : spdlog::source_loc{};
+      logging::log(*logger, location, Level, spdlog::string_view_t(msg, len));
+      return 0;
+    }
   }
 
-  void reroute_log(const std::string& path) {
+  void reroute_log(const sol::this_state& state, const std::string& path) {
+    // log file is shared by all scripts of serve and batch, theirs go to the route
+    if (get_script_run(state) != nullptr) {
+      throw std::runtime_error("core.reroute_log is not available to scripts run by serve or batch");
+    }
     const auto& logger = spdlog::get("default");
 
     // rename temp file to @path
     for (const auto& sink : logger->sinks()) {
-      auto sink_inst = std::dynamic_pointer_cast<logging::detail::temp_file_sink_mt>(sink);
+      auto sink_inst = std::dynamic_pointer_cast<logging::detail::rerouteable_sink>(sink);
       if (sink_inst) {
         sink_inst->rename(path);
         break;
@@ -70,7 +274,8 @@ namespace rostrum {
     std::filesystem::path file_path = path;
   }
 
-  void set_log_level(const std::string& level) {
+  // scripts run by serve or batch filter their log route only, below the level of the host nothing is logged
+  void set_log_level(const sol::this_state& state, const std::string& level) {
     auto enum_lvl = spdlog::level::off;
 
     if (level == "trace") {
@@ -95,9 +300,332 @@ namespace rostrum {
       throw std::runtime_error(std::string("unsupported log level specified: ") + level);
     }
 
+    if (const auto run = get_script_run(state)) {
+      run->log_level.store(enum_lvl, std::memory_order_relaxed);
+      return;
+    }
     spdlog::get("default")->set_level(enum_lvl);
   }
 
+  void configure_log(const sol::table& opts) {
+    auto options = logging::logger_guard::get_options();
+    options.queue_size = opts.get_or("queue_size", options.queue_size);
+    options.threads = opts.get_or("threads", options.threads);
+    if (const auto overflow = opts.get<sol::optional<std::string>>("overflow")) {
+      options.overflow = logging::parse_overflow_policy(*overflow);
+    }
+    logging::logger_guard::reconfigure(options);
+  }
+
+  // durability point. returns false on timeout
+  bool sync_log(const sol::optional<std::uint32_t> timeout_ms) {
+    return logging::sync(*spdlog::get("default"), std::chrono::milliseconds(timeout_ms.value_or(5000)));
+  }
+
+  sol::table get_log_stats(const sol::this_state& state) {
+    const auto stats = logging::get_statistics();
+    return sol::state_view(state).create_table_with(
+      "queue_depth", stats.queue_depth,
+      "queue_size", stats.queue_size,
+      "enqueued", stats.enqueued,
+      "dropped_newest", stats.dropped_newest,
+      "overrun_oldest", stats.overrun_oldest,
+      "enqueue_ns_total", stats.enqueue_ns_total,
+      "enqueue_ns_max", stats.enqueue_ns_max,
+      "flushes", stats.flushes,
+      "flush_ns_total", stats.flush_ns_total,
+      "flush_ns_max", stats.flush_ns_max);
+  }
+
+  void profile_start(const sol::this_state& state, const sol::optional<sol::table>& opts) {
+    profiler::options options;
+    if (opts) {
+      options.interval_ms = opts->get_or("interval_ms", options.interval_ms);
+      options.depth = opts->get_or("depth", options.depth);
+      options.vm_states = opts->get_or("vm_states", options.vm_states);
+    }
+    profiler::get_instance().start(state, options);
+  }
+
+  sol::table profile_stop(const sol::this_state& state, const std::string& path) {
+    const auto stats = profiler::get_instance().stop(path);
+    return sol::state_view(state).create_table_with(
+      "samples", stats.samples,
+      "stacks", stats.stacks);
+  }
+
+  void memprofile_start(const sol::this_state& state, const sol::optional<sol::table>& opts) {
+    memprofile::options options;
+    if (opts) {
+      options.interval = opts->get_or("interval", options.interval);
+      options.depth = opts->get_or("depth", options.depth);
+    }
+    memprofile::start(state, options);
+  }
+
+  sol::table memprofile_stop(const sol::this_state& state, const std::string& path, const sol::optional<std::size_t> top) {
+    const auto stats = memprofile::stop(state, path, top.value_or(20));
+    sol::state_view lua = state;
+
+    auto sites = lua.create_table(static_cast<int>(std::size(stats.top)));
+    for (std::size_t i = 0; i < std::size(stats.top); ++i) {
+      const auto& s = stats.top[i];
+      sites[i + 1] = lua.create_table_with(
+        "site", s.name,
+        "allocated", s.allocated,
+        "live", s.live,
+        "samples", s.samples);
+    }
+    return lua.create_table_with(
+      "samples", stats.samples,
+      "stacks", stats.stacks,
+      "top", sites);
+  }
+
+  // per binding metrics. empty if disabled
+  sol::table get_metrics(const sol::this_state& state) {
+    sol::state_view lua = state;
+    auto result = lua.create_table();
+    for (const auto& binding : metrics::collect()) {
+      auto module = result[binding.module].get_or_create<sol::table>();
+      auto histogram = lua.create_table(static_cast<int>(metrics::kBuckets));
+      for (std::size_t i = 0; i < metrics::kBuckets; ++i) {
+        histogram[i + 1] = binding.histogram[i];
+      }
+      module[binding.name] = lua.create_table_with(
+        "calls", binding.calls,
+        "total_ns", binding.total_ns,
+        "histogram_log2_ns", histogram);
+    }
+    return result;
+  }
+
+  sol::table run_bench(const sol::this_state& state, const sol::protected_function& fn, const sol::optional<sol::table>& opts) {
+    bench::options options;
+    if (opts) {
+      options.name = opts->get_or("name", options.name);
+      options.warmup = opts->get_or("warmup", options.warmup);
+      options.min_time = opts->get_or("min_time", options.min_time);
+      options.repetitions = opts->get_or("repetitions", options.repetitions);
+      options.gc = opts->get_or("gc", options.gc);
+      options.baseline = opts->get_or("baseline", options.baseline);
+      options.save = opts->get_or("save", options.save);
+      options.threshold = opts->get_or("threshold", options.threshold);
+    }
+
+    sol::state_view lua = state;
+    fn.push();
+    const auto r = [&] {
+      try {
+        return bench::run(lua, -1, options);
+      }
+      catch (...) {
+        lua_pop(lua, 1);
+        throw;
+      }
+    }();
+    lua_pop(lua, 1);
+
+    auto result = lua.create_table_with(
+      "iterations", r.iterations,
+      "repetitions", r.repetitions,
+      "median_ns", r.median_ns,
+      "p99_ns", r.p99_ns,
+      "mad_ns", r.mad_ns,
+      "min_ns", r.min_ns,
+      "mean_ns", r.mean_ns,
+      "regression", r.regression);
+    if (r.baseline_ns) {
+      result["baseline_ns"] = *r.baseline_ns;
+      result["change"] = *r.change;
+    }
+    return result;
+  }
+
+  msgpack::pack_options to_pack_options(const sol::optional<sol::table>& opts) {
+    msgpack::pack_options options;
+    if (opts) {
+      options.detect_cycles = opts->get_or("cycles", options.detect_cycles);
+    }
+    return options;
+  }
+
+  // packed value as buffer, or as lua string if opts.string is set
+  sol::object pack(const sol::this_state& state, const sol::stack_object& value, const sol::optional<sol::table>& opts) {
+    lua_State* L = state;
+    const auto options = to_pack_options(opts);
+    const auto top = lua_gettop(L);
+
+    // strings are packed into reused scratch buffer. buffers adopt their storage and start from last seen size.
+    // both are bounded, so one large value does not pin its size for small ones
+    constexpr std::size_t kMaxRetained = 64 * 1024;
+    thread_local std::string scratch;
+    thread_local std::size_t size_hint = 0;
+    try {
+      if (opts && opts->get_or("string", false)) {
+        scratch.clear();
+        msgpack::pack(L, value.stack_index(), scratch, options);
+        auto result = sol::make_object(L, std::string_view(scratch));
+        if (scratch.capacity() > kMaxRetained) {
+          scratch = {};
+        }
+        return result;
+      }
+
+      std::string bytes;
+      bytes.reserve(size_hint);
+      msgpack::pack(L, value.stack_index(), bytes, options);
+      size_hint = (std::min)(std::size(bytes), kMaxRetained);
+      if (bytes.capacity() - std::size(bytes) > (std::max)(std::size(bytes), kMaxRetained)) {
+        bytes.shrink_to_fit();
+      }
+      return sol::make_object(L, api::buffer::adopt(std::move(bytes)));
+    }
+    catch (...) {
+      lua_settop(L, top);
+      throw;
+    }
+  }
+
+  // stream packed value to file. returns number of written bytes
+  std::size_t pack_file(const sol::this_state& state, const std::string& path, const sol::stack_object& value, const sol::optional<sol::table>& opts) {
+    lua_State* L = state;
+    const auto options = to_pack_options(opts);
+    const auto top = lua_gettop(L);
+
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> file(std::fopen(path.c_str(), "wb"), &std::fclose);
+    if (!file) {
+      throw std::runtime_error("cannot open '" + path + "'");
+    }
+    std::size_t written;
+    try {
+      written = msgpack::pack(L, value.stack_index(), file.get(), options);
+    }
+    catch (...) {
+      lua_settop(L, top);
+      throw;
+    }
+    // buffered bytes are written on close, which can fail too, e.g. when the disk is full
+    if (std::fclose(file.release()) != 0) {
+      throw std::runtime_error("cannot write '" + path + "'");
+    }
+    return written;
+  }
+
+  // value decoded from string or buffer at 1-based @pos, and position after it
+  std::tuple<sol::object, std::size_t> unpack(const sol::this_state& state, const sol::stack_object& data, const sol::optional<std::size_t> pos) {
+    lua_State* L = state;
+    const auto top = lua_gettop(L);
+
+    const auto source = api::to_buffer(L, data.stack_index());
+    std::string_view bytes;
+    if (source != nullptr) {
+      bytes = source->view();
+    }
+    else if (data.get_type() == sol::type::string) {
+      bytes = data.as<std::string_view>();
+    }
+    else {
+      throw std::runtime_error("unpack expects string or buffer");
+    }
+
+    const auto offset = pos.value_or(1);
+    if (offset == 0) {
+      throw std::runtime_error("unpack position starts at 1");
+    }
+    try {
+      const auto next = msgpack::unpack(L, bytes, offset - 1, source);
+      sol::object result(L, -1);
+      lua_pop(L, 1);
+      return { std::move(result), next + 1 };
+    }
+    catch (...) {
+      lua_settop(L, top);
+      throw;
+    }
+  }
+
+  // usage of the state budget and its limits, 0 is unlimited
+  sol::table get_budget_usage(const sol::this_state& state) {
+    const auto used = budget::get_usage(state);
+    const auto limits = budget::get_limits(state);
+    sol::state_view lua = state;
+    return lua.create_table_with(
+      "instructions", used.instructions,
+      "time_ms", used.time.count(),
+      "heap_bytes", used.heap_bytes,
+      "peak_heap_bytes", used.peak_heap_bytes,
+      "limits", lua.create_table_with(
+        "instructions", limits.instructions,
+        "time_ms", limits.time.count(),
+        "heap_bytes", limits.heap_bytes));
+  }
+
+  sol::table get_gc_stats(const sol::this_state& state) {
+    const auto stats = gc::get_stats(state);
+    sol::state_view lua = state;
+
+    const auto histogram = [&lua](const std::array<std::uint64_t, gc::kBuckets>& buckets) {
+      auto result = lua.create_table(static_cast<int>(gc::kBuckets));
+      for (std::size_t i = 0; i < gc::kBuckets; ++i) {
+        result[i + 1] = buckets[i];
+      }
+      return result;
+    };
+    return lua.create_table_with(
+      "heap_bytes", stats.heap_bytes,
+      "peak_heap_bytes", stats.peak_heap_bytes,
+      "cycles", stats.cycles,
+      "explicit_steps", stats.explicit_steps,
+      "explicit_collections", stats.explicit_collections,
+      "explicit_step_ns_total", stats.explicit_step_ns_total,
+      "explicit_collection_ns_total", stats.explicit_collection_ns_total,
+      "explicit_step_histogram_log2_ns", histogram(stats.explicit_step_histogram),
+      "explicit_collection_histogram_log2_ns", histogram(stats.explicit_collection_histogram));
+  }
+
+  // returns previous parameters
+  sol::table gc_tune(const sol::this_state& state, const sol::table& params) {
+    gc::tuning tuning;
+    tuning.pause = params.get_or("pause", 0);
+    tuning.stepmul = params.get_or("stepmul", 0);
+    const auto previous = gc::tune(state, tuning);
+    return sol::state_view(state).create_table_with(
+      "pause", previous.pause,
+      "stepmul", previous.stepmul);
+  }
+
+  sol::table get_topology(const sol::this_state& state) {
+    sol::state_view lua = state;
+    const auto& cpu = sysinfo::get_topology();
+
+    auto caches = lua.create_table(static_cast<int>(std::size(cpu.caches)));
+    for (const auto& cache : cpu.caches) {
+      caches.add(lua.create_table_with(
+        "level", cache.level,
+        "size", cache.size,
+        "line_size", cache.line_size,
+        "associativity", cache.associativity,
+        "type", cache.type));
+    }
+
+    auto isa = lua.create_table(0, static_cast<int>(std::size(cpu.instruction_sets)));
+    for (const auto& [name, supported] : cpu.instruction_sets) {
+      isa[name] = supported;
+    }
+
+    return lua.create_table_with(
+      "logical", cpu.logical,
+      "physical", cpu.physical,
+      "packages", cpu.packages,
+      "frequency", cpu.frequency,
+      "architecture", cpu.architecture,
+      "model_name", cpu.model_name,
+      "vendor_id", cpu.vendor_id,
+      "caches", caches,
+      "isa", isa);
+  }
+
   sol::table imbue_core(sol::state_view& lua) {
     // TODO: constexpr parse for k/v
     auto core_table = lua.create_table();
@@ -116,7 +644,8 @@ namespace rostrum {
       "jit", sol::lib::jit,
       "utf8", sol::lib::utf8);
 
-    core_table.set_function("get_elapsed_time", get_elapsed_time);
+    // timing functions are called from hot loops. fast bindings skip sol trampoline
+    core_table.set("get_elapsed_time", &api::fast<&get_elapsed_time>);
     core_table.set_function("load_lua_libs", load_lua_libs);
     core_table.set_function("load_file_whash", load_file_whash);
     core_table.set_function("set_log_level", set_log_level);
@@ -125,27 +654,114 @@ namespace rostrum {
 
     spdlog::debug("imbuing lua state with core functions: get_elapsed_time,load_lua_libs,load_file_whash,set_log_level,reroute_log,print_system_info");
 
+    core_table.set_function("get_topology", get_topology);
+    core_table.set_function("set_thread_affinity", [](const sol::this_state& state, const std::vector<std::size_t>& cpus) {
+      // runner threads are reused, so the affinity they had is restored after the script
+      if (const auto run = get_script_run(state); run != nullptr && !run->affinity) {
+        run->affinity = sysinfo::get_thread_affinity();
+      }
+      sysinfo::set_thread_affinity(cpus);
+    });
+
+    spdlog::debug("imbuing lua state with core functions: get_topology,set_thread_affinity");
+
+    core_table.set_function("map_file", lua_buffer::map_file);
+    core_table.set_function("buffer", [](const std::string_view bytes) { return api::buffer::copy(bytes); });
+
+    spdlog::debug("imbuing lua state with core functions: map_file,buffer");
+
+    core_table.set_function("pack", pack);
+    core_table.set_function("pack_file", pack_file);
+    core_table.set_function("unpack", unpack);
+
+    spdlog::debug("imbuing lua state with core functions: pack,pack_file,unpack");
+
+    core_table["async"] = async::imbue(lua);
+
+    spdlog::debug("imbuing lua state with core functions: async.run,async.spawn,async.sleep,async.read_file,async.spawn_process,async.wait_all");
+
+    // hot reload of rostrum modules
+    core_table.set_function("on_module_reload", [](const sol::this_state& state, const sol::protected_function& hook) {
+      sol::state_view lua = state;
+      manager::get_instance().on_module_reload(lua, hook);
+    });
+    core_table.set_function("poll_module_reloads", [](const sol::this_state& state) {
+      sol::state_view lua = state;
+      return manager::get_instance().poll_reloads(lua);
+    });
+
+    spdlog::debug("imbuing lua state with core functions: on_module_reload,poll_module_reloads");
+
+    // parallel execution on worker states
+    core_table.set_function("submit", submit);
+    core_table.set_function("wait", wait);
+    core_table.set_function("wait_completions", wait_completions);
+    core_table.set_function("poll", [](const sol::this_state& state, const sol::optional<std::size_t> max) {
+      return completion_queue::poll(state, max.value_or(completion_queue::kCapacity));
+    });
+    core_table.set_function("parallel_map", parallel_map);
+    core_table.set_function("worker_count", [] { return worker_pool::get_instance().size(); });
+
+    spdlog::debug("imbuing lua state with core functions: submit,wait,wait_completions,poll,parallel_map,worker_count");
+
+    core_table.set_function("get_bytecode_cache_stats", get_bytecode_cache_stats);
+    core_table.set_function("set_bytecode_cache_limit", [](const std::uintmax_t limit) { bytecode_cache::get_instance().set_limit(limit); });
+
+    spdlog::debug("imbuing lua state with core functions: get_bytecode_cache_stats,set_bytecode_cache_limit");
+
+    core_table.set_function("profile_start", profile_start);
+    core_table.set_function("profile_stop", profile_stop);
+
+    spdlog::debug("imbuing lua state with core functions: profile_start,profile_stop");
+
+    core_table.set_function("memprofile_start", memprofile_start);
+    core_table.set_function("memprofile_stop", memprofile_stop);
+
+    spdlog::debug("imbuing lua state with core functions: memprofile_start,memprofile_stop");
+
+    core_table.set_function("metrics", get_metrics);
+
+    spdlog::debug("imbuing lua state with core functions: metrics");
+
+    core_table.set_function("budget_usage", get_budget_usage);
+
+    spdlog::debug("imbuing lua state with core functions: budget_usage");
+
+    core_table.set_function("gc_stats", get_gc_stats);
+    core_table.set_function("gc_tune", gc_tune);
+    // incremental collection in idle windows. returns true if the cycle finished
+    core_table.set_function("gc_step_budget", [](const sol::this_state& state, const double us) {
+      return gc::step_budget(state, duration_cast<microseconds>(duration<double, std::micro>(us)));
+    });
+
+    spdlog::debug("imbuing lua state with core functions: gc_stats,gc_tune,gc_step_budget");
+
+    core_table.set("clock_ns", &api::fast<&bench::clock_ns>);
+    core_table.set_function("bench", run_bench);
+
+    spdlog::debug("imbuing lua state with core functions: clock_ns,bench");
+
+#ifdef ROSTRUM_BENCH
+    // nested table is not instrumented by metrics, so both paths are measured bare
+    core_table["bench_bindings"] = lua.create_table_with(
+      "fast", &api::fast<&bench_add>,
+      "safe", bench_add);
+
+    spdlog::debug("imbuing lua state with core functions: bench_bindings");
+#endif
+
     // logging stuff
-    static auto logger = spdlog::get("default");
-    static auto trace = [](const std::string& msg) { logger->trace(msg); };
-    static auto debug = [](const std::string& msg) { logger->debug(msg); };
-    static auto info = [](const std::string& msg) { logger->info(msg); };
-    static auto warn = [](const std::string& msg) { logger->warn(msg); };
-    static auto error = [](const std::string& msg) { logger->error(msg); };
-
-    auto log_trace = [](const sol::this_state& state, const std::string& msg) { log_with_info(state, trace, msg); };
-    auto log_debug = [](const sol::this_state& state, const std::string& msg) { log_with_info(state, debug, msg); };
-    auto log_info = [](const sol::this_state& state, const std::string& msg) { log_with_info(state, info, msg); };
-    auto log_warn = [](const sol::this_state& state, const std::string& msg) { log_with_info(state, warn, msg); };
-    auto log_error = [](const sol::this_state& state, const std::string& msg) { log_with_info(state, error, msg); };
-
-    core_table.set_function("log_trace", log_trace);
-    core_table.set_function("log_debug", log_debug);
-    core_table.set_function("log_info", log_info);
-    core_table.set_function("log_warn", log_warn);
-    core_table.set_function("log_error", log_error);
-
-    spdlog::debug("imbuing lua state with core functions: log_trace,log_debug,log_info,log_warn,log_error");
+    core_table.set("log_trace", &log_at<spdlog::level::trace>);
+    core_table.set("log_debug", &log_at<spdlog::level::debug>);
+    core_table.set("log_info", &log_at<spdlog::level::info>);
+    core_table.set("log_warn", &log_at<spdlog::level::warn>);
+    core_table.set("log_error", &log_at<spdlog::level::err>);
+
+    core_table.set_function("configure_log", configure_log);
+    core_table.set_function("get_log_stats", get_log_stats);
+    core_table.set_function("sync_log", sync_log);
+
+    spdlog::debug("imbuing lua state with core functions: log_trace,log_debug,log_info,log_warn,log_error,configure_log,get_log_stats,sync_log");
 
     return core_table;
   }
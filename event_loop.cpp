@@ -0,0 +1,575 @@
+#include <array>
+#include <mutex>
+#include <deque>
+#include <cstdio>
+#include <utility>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+#ifndef _WIN32
+# include <sys/wait.h>
+#endif
+
+#include "event_loop.h"
+#include "include/buffer.hpp"
+
+namespace rostrum::async {
+  namespace {
+    using clock = std::chrono::steady_clock;
+
+    // pushes results onto resumed coroutine. returns number of results
+    using completion = std::function<int(lua_State* co)>;
+
+    /*
+     * Hashed timer wheel with 1 ms ticks. Timers further than one rotation wait for their round.
+     */
+    class timer_wheel final {
+    public:
+      static constexpr std::size_t kSlots = 512;
+      static constexpr auto kTick = std::chrono::milliseconds(1);
+
+      explicit timer_wheel(const clock::time_point now) : current_(now) {
+      }
+
+      void add(const clock::time_point deadline, lua_State* co) {
+        const auto ticks = static_cast<std::size_t>((std::max)(std::chrono::ceil<std::chrono::milliseconds>(deadline - current_).count(), std::chrono::milliseconds::rep{ 1 }));
+        slots_[(slot_ + ticks) % kSlots].push_back({ co, (ticks - 1) / kSlots });
+        ++size_;
+      }
+
+      // collect coroutines of expired timers
+      void advance(const clock::time_point now, std::vector<lua_State*>& expired) {
+        while (current_ + kTick <= now) {
+          current_ += kTick;
+          slot_ = (slot_ + 1) % kSlots;
+
+          auto& slot = slots_[slot_];
+          for (auto it = std::begin(slot); it != std::end(slot);) {
+            if (it->rounds == 0) {
+              expired.push_back(it->co);
+              it = slot.erase(it);
+              --size_;
+            }
+            else {
+              --it->rounds;
+              ++it;
+            }
+          }
+        }
+      }
+
+      // time of the next occupied slot. a timer there may still wait for its round
+      [[nodiscard]] clock::time_point next() const {
+        for (std::size_t i = 1; i <= kSlots; ++i) {
+          if (!slots_[(slot_ + i) % kSlots].empty()) {
+            return current_ + kTick * static_cast<int>(i);
+          }
+        }
+        return clock::time_point::max();
+      }
+
+      [[nodiscard]] bool empty() const noexcept {
+        return size_ == 0;
+      }
+
+    private:
+      struct timer {
+        lua_State* co;
+        std::size_t rounds;
+      };
+
+      std::array<std::vector<timer>, kSlots> slots_;
+      std::size_t slot_{ 0 };
+      std::size_t size_{ 0 };
+      clock::time_point current_;
+    };
+
+    /*
+     * Threads waiting for spawned processes, shared by all loops. At most kThreads processes run at once,
+     * later ones are queued. Threads live until exit, so loops never wait for processes on destruction.
+     */
+    class process_pool final {
+    public:
+      static constexpr std::size_t kThreads = 16;
+
+      static process_pool& get_instance() {
+        // never destroyed, its threads may still wait for processes at exit
+        static auto* const instance = new process_pool();
+        return *instance;
+      }
+
+      void submit(std::function<void()> job) {
+        {
+          std::scoped_lock lock(mutex_);
+          jobs_.push_back(std::move(job));
+          if (threads_ < kThreads && std::size(jobs_) > idle_) {
+            ++threads_;
+            std::thread(&process_pool::worker, this).detach();
+          }
+        }
+        cv_.notify_one();
+      }
+
+    private:
+      process_pool() = default;
+
+      void worker() {
+        while (true) {
+          std::function<void()> job;
+          {
+            std::unique_lock lock(mutex_);
+            ++idle_;
+            cv_.wait(lock, [this] { return !jobs_.empty(); });
+            --idle_;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+          }
+          job();
+        }
+      }
+
+      std::mutex mutex_;
+      std::condition_variable cv_;
+      std::deque<std::function<void()>> jobs_;
+      std::size_t threads_{ 0 };
+      std::size_t idle_{ 0 };
+    };
+
+    class event_loop final {
+    public:
+      static constexpr std::size_t kIoThreads = 4;
+
+      explicit event_loop(lua_State* L) : L_(L), timers_(clock::now()), mailbox_(std::make_shared<mailbox>()) {
+      }
+
+      event_loop(const event_loop&) = delete;
+      event_loop& operator= (const event_loop&) = delete;
+
+      ~event_loop() {
+        // processes are not waited for. pool threads drop completions of a closed loop and skip its queued jobs
+        {
+          std::scoped_lock lock(mailbox_->mutex);
+          mailbox_->closed = true;
+        }
+        {
+          std::scoped_lock lock(mutex_);
+          stop_ = true;
+        }
+        jobs_cv_.notify_all();
+        for (auto& t : threads_) {
+          t.join();
+        }
+        for (const auto& [co, ref] : tasks_) {
+          luaL_unref(L_, LUA_REGISTRYINDEX, ref);
+        }
+      }
+
+      static event_loop& current(lua_State* L) {
+        if (current_ == nullptr) {
+          luaL_error(L, "core.async operations must be called inside core.async.run");
+        }
+        if (current_->tasks_.count(L) == 0) {
+          luaL_error(L, "core.async operations must be called from a task, not from a nested coroutine");
+        }
+        return *current_;
+      }
+
+      [[nodiscard]] static bool running() noexcept {
+        return current_ != nullptr;
+      }
+
+      // move function and @nargs arguments from top of @L into new task. returns the task coroutine
+      lua_State* spawn(lua_State* L, const int nargs) {
+        const auto co = lua_newthread(L);
+        const auto ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        lua_xmove(L, co, nargs + 1);
+        tasks_.emplace(co, ref);
+        ready_.push_back({ co, nargs, nullptr });
+        return co;
+      }
+
+      void sleep(lua_State* co, const double seconds) {
+        const auto duration = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>((std::max)(seconds, 0.0)));
+        timers_.add(clock::now() + duration, co);
+      }
+
+      // run @job on io thread. its completion resumes @co
+      void submit(lua_State* co, std::function<completion()> job) {
+        mailbox_->begin();
+        {
+          std::scoped_lock lock(mutex_);
+          if (threads_.size() < kIoThreads && idle_ == 0) {
+            threads_.emplace_back(&event_loop::io_thread, this);
+          }
+          jobs_.push_back([box = mailbox_, co, job = std::move(job)] {
+            box->complete(co, job());
+          });
+        }
+        jobs_cv_.notify_one();
+      }
+
+      // run @job on the process pool, e.g. if it blocks for unknown time. loop does not wait for it on destruction
+      void submit_process(lua_State* co, std::function<completion()> job) {
+        mailbox_->begin();
+        process_pool::get_instance().submit([box = mailbox_, co, job = std::move(job)] {
+          // queued jobs of a closed loop are not started
+          box->complete(co, box->is_closed() ? nullptr : job());
+        });
+      }
+
+      // wait_all: @waiter is resumed with table of first results when all @tasks finish
+      void wait_all(lua_State* waiter, const std::vector<lua_State*>& tasks) {
+        auto group = std::make_shared<wait_group>();
+        group->waiter = waiter;
+        group->remaining = std::size(tasks);
+        lua_newtable(waiter);
+        group->results_ref = luaL_ref(waiter, LUA_REGISTRYINDEX);
+        for (std::size_t i = 0; i < std::size(tasks); ++i) {
+          groups_[tasks[i]] = { group, i + 1 };
+        }
+        if (tasks.empty()) {
+          resume_group(*group);
+        }
+      }
+
+      // drive the loop. main task is on top of L_ with its arguments. returns number of its results left on L_
+      int run(const int nargs) {
+        const auto previous = std::exchange(current_, this);
+        try {
+          const auto main = spawn(L_, nargs);
+          auto main_results = 0;
+
+          std::vector<lua_State*> expired;
+          while (!tasks_.empty()) {
+            while (!ready_.empty()) {
+              auto r = std::move(ready_.front());
+              ready_.pop_front();
+              const auto nresults = resume(r, main);
+              if (nresults >= 0) {
+                main_results = nresults;
+              }
+            }
+            if (tasks_.empty()) {
+              break;
+            }
+
+            timers_.advance(clock::now(), expired);
+            for (const auto co : expired) {
+              ready_.push_back({ co, 0, nullptr });
+            }
+            expired.clear();
+            if (!ready_.empty()) {
+              continue;
+            }
+
+            auto& box = *mailbox_;
+            std::unique_lock lock(box.mutex);
+            if (box.completed.empty() && box.in_flight == 0 && timers_.empty()) {
+              throw std::runtime_error("core.async deadlock: tasks are waiting but no operation is pending");
+            }
+            const auto ready = [&box] { return !box.completed.empty(); };
+            if (timers_.empty()) {
+              box.done_cv.wait(lock, ready);
+            }
+            else {
+              box.done_cv.wait_until(lock, timers_.next(), ready);
+            }
+            while (!box.completed.empty()) {
+              ready_.push_back(std::move(box.completed.front()));
+              box.completed.pop_front();
+            }
+          }
+
+          current_ = previous;
+          return main_results;
+        }
+        catch (...) {
+          current_ = previous;
+          throw;
+        }
+      }
+
+    private:
+      struct resumption {
+        lua_State* co;
+        int nargs;
+        completion push;
+      };
+
+      struct wait_group {
+        lua_State* waiter;
+        std::size_t remaining;
+        int results_ref;
+      };
+
+      // completions of io jobs. shared with process pool threads, which outlive the loop
+      struct mailbox {
+        std::mutex mutex;
+        std::condition_variable done_cv;
+        std::deque<resumption> completed;
+        std::size_t in_flight{ 0 };
+        bool closed{ false };
+
+        void begin() {
+          std::scoped_lock lock(mutex);
+          ++in_flight;
+        }
+
+        bool is_closed() {
+          std::scoped_lock lock(mutex);
+          return closed;
+        }
+
+        void complete(lua_State* co, completion done) {
+          {
+            std::scoped_lock lock(mutex);
+            --in_flight;
+            if (closed) {
+              return;
+            }
+            completed.push_back({ co, 0, std::move(done) });
+          }
+          done_cv.notify_one();
+        }
+      };
+
+      void io_thread() {
+        while (true) {
+          std::function<void()> job;
+          {
+            std::unique_lock lock(mutex_);
+            ++idle_;
+            jobs_cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+            --idle_;
+            if (jobs_.empty()) {
+              return;
+            }
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+          }
+          job();
+        }
+      }
+
+      void resume_group(wait_group& group) {
+        lua_rawgeti(group.waiter, LUA_REGISTRYINDEX, group.results_ref);
+        luaL_unref(group.waiter, LUA_REGISTRYINDEX, group.results_ref);
+        ready_.push_back({ group.waiter, 1, nullptr });
+      }
+
+      // returns number of results of finished main task, -1 otherwise
+      int resume(resumption& r, lua_State* main) {
+        const auto co = r.co;
+        const auto nargs = r.push ? r.push(co) : r.nargs;
+        const auto status = lua_resume(co, nargs);
+        if (status == LUA_YIELD) {
+          return -1;
+        }
+
+        const auto task = tasks_.find(co);
+        const auto ref = task->second;
+        tasks_.erase(task);
+
+        if (status != 0) {
+          std::string error = lua_tostring(co, -1) != nullptr ? lua_tostring(co, -1) : "unknown error";
+          luaL_unref(L_, LUA_REGISTRYINDEX, ref);
+          throw std::runtime_error("core.async task failed: " + error);
+        }
+
+        // first result goes to wait_all group
+        if (const auto g = groups_.find(co); g != std::end(groups_)) {
+          auto [group, index] = g->second;
+          groups_.erase(g);
+          const auto nresults = lua_gettop(co);
+          luaL_checkstack(co, 2, "wait_all");
+          lua_rawgeti(co, LUA_REGISTRYINDEX, group->results_ref);
+          if (nresults > 0) {
+            lua_pushvalue(co, 1);
+          }
+          else {
+            lua_pushnil(co);
+          }
+          lua_rawseti(co, -2, static_cast<int>(index));
+          lua_pop(co, 1);
+          if (--group->remaining == 0) {
+            resume_group(*group);
+          }
+        }
+
+        auto nresults = -1;
+        if (co == main) {
+          nresults = lua_gettop(co);
+          lua_xmove(co, L_, nresults);
+        }
+        luaL_unref(L_, LUA_REGISTRYINDEX, ref);
+        return nresults;
+      }
+
+      inline static thread_local event_loop* current_{ nullptr };
+
+      lua_State* L_;
+      std::unordered_map<lua_State*, int> tasks_;
+      std::unordered_map<lua_State*, std::pair<std::shared_ptr<wait_group>, std::size_t>> groups_;
+      std::deque<resumption> ready_;
+      timer_wheel timers_;
+
+      std::shared_ptr<mailbox> mailbox_;
+
+      // io threads
+      std::mutex mutex_;
+      std::condition_variable jobs_cv_;
+      std::deque<std::function<void()>> jobs_;
+      std::vector<std::thread> threads_;
+      std::size_t idle_{ 0 };
+      bool stop_{ false };
+    };
+
+    completion failure(std::string error) {
+      return [error = std::move(error)](lua_State* co) {
+        lua_pushnil(co);
+        lua_pushlstring(co, std::data(error), std::size(error));
+        return 2;
+      };
+    }
+
+    int run(lua_State* L) {
+      luaL_checktype(L, 1, LUA_TFUNCTION);
+      if (event_loop::running()) {
+        return luaL_error(L, "core.async.run cannot be nested");
+      }
+
+      std::string error;
+      {
+        try {
+          event_loop loop(L);
+          const auto nresults = loop.run(lua_gettop(L) - 1);
+          return nresults;
+        }
+        catch (const std::exception& e) {
+          error = e.what();
+        }
+      }
+      // raise after loop is destroyed
+      return luaL_error(L, "%s", error.c_str());
+    }
+
+    int spawn(lua_State* L) {
+      luaL_checktype(L, 1, LUA_TFUNCTION);
+      auto& loop = event_loop::current(L);
+      loop.spawn(L, lua_gettop(L) - 1);
+      return 0;
+    }
+
+    int sleep(lua_State* L) {
+      auto& loop = event_loop::current(L);
+      loop.sleep(L, luaL_checknumber(L, 1));
+      return lua_yield(L, 0);
+    }
+
+    int read_file(lua_State* L) {
+      auto& loop = event_loop::current(L);
+      std::string path = luaL_checkstring(L, 1);
+      loop.submit(L, [path = std::move(path)]() -> completion {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+          return failure(path + " not found");
+        }
+        // read in blocks. size is only a hint as the file may change meanwhile
+        constexpr std::size_t kBlock = 64 * 1024;
+        std::string content;
+        std::error_code ec;
+        if (const auto size = std::filesystem::file_size(path, ec); !ec) {
+          content.reserve(static_cast<std::size_t>(size) + kBlock);
+        }
+        while (in) {
+          const auto offset = std::size(content);
+          content.resize(offset + kBlock);
+          in.read(std::data(content) + offset, static_cast<std::streamsize>(kBlock));
+          content.resize(offset + static_cast<std::size_t>(in.gcount()));
+        }
+        if (in.bad()) {
+          return failure("cannot read " + path);
+        }
+        return [content = std::make_shared<std::string>(std::move(content))](lua_State* co) {
+          api::push_buffer(co, api::buffer::adopt(std::move(*content)));
+          return 1;
+        };
+      });
+      return lua_yield(L, 0);
+    }
+
+    int spawn_process(lua_State* L) {
+      auto& loop = event_loop::current(L);
+      std::string command = luaL_checkstring(L, 1);
+      // processes may run for long, so they do not occupy io threads
+      loop.submit_process(L, [command = std::move(command)]() -> completion {
+#ifdef _WIN32
+        const auto pipe = _popen(command.c_str(), "rb");
+#else
+        const auto pipe = popen(command.c_str(), "r");
+#endif
+        if (pipe == nullptr) {
+          return failure("cannot start '" + command + '\'');
+        }
+
+        std::string output;
+        char chunk[4096];
+        for (std::size_t n; (n = std::fread(chunk, 1, sizeof(chunk), pipe)) > 0;) {
+          output.append(chunk, n);
+        }
+
+#ifdef _WIN32
+        const auto code = _pclose(pipe);
+#else
+        const auto status = pclose(pipe);
+        const auto code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+        return [code, output = std::make_shared<std::string>(std::move(output))](lua_State* co) {
+          lua_pushinteger(co, code);
+          api::push_buffer(co, api::buffer::adopt(std::move(*output)));
+          return 2;
+        };
+      });
+      return lua_yield(L, 0);
+    }
+
+    int wait_all(lua_State* L) {
+      luaL_checktype(L, 1, LUA_TTABLE);
+      auto& loop = event_loop::current(L);
+
+      std::vector<lua_State*> tasks;
+      const auto count = static_cast<int>(lua_objlen(L, 1));
+      luaL_checkstack(L, 2, "wait_all");
+      for (auto i = 1; i <= count; ++i) {
+        lua_rawgeti(L, 1, i);
+        if (!lua_isfunction(L, -1)) {
+          return luaL_error(L, "wait_all expects list of functions, element %d is %s", i, luaL_typename(L, -1));
+        }
+        tasks.push_back(loop.spawn(L, 0));
+      }
+      loop.wait_all(L, tasks);
+      return lua_yield(L, 0);
+    }
+  }
+
+  sol::table imbue(sol::state_view& lua) {
+    // raw functions since they yield. not instrumented as core.async is a nested table
+    auto t = lua.create_table();
+    t.set("run", &run);
+    t.set("spawn", &spawn);
+    t.set("sleep", &sleep);
+    t.set("read_file", &read_file);
+    t.set("spawn_process", &spawn_process);
+    t.set("wait_all", &wait_all);
+    return t;
+  }
+}
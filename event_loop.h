@@ -0,0 +1,19 @@
+#pragma once
+#include "include/api.hpp"
+
+namespace rostrum::async {
+
+  /*
+   * core.async: coroutine based event loop.
+   *   run(fn, ...)            run fn as a task and drive the loop until all tasks finish. returns fn results
+   *   spawn(fn, ...)          start another task
+   *   sleep(seconds)
+   *   read_file(path)         buffer or nil, error
+   *   spawn_process(command)  exit code and stdout buffer, or nil, error. not waited for if the loop stops early.
+   *                           at most 16 processes run at once across all loops, later ones are queued
+   *   wait_all({fn, ...})     run functions as tasks, returns table of their first results
+   * All but run must be called from a task and yield it until the operation completes.
+   */
+  [[nodiscard]]
+  sol::table imbue(sol::state_view& lua);
+}
@@ -0,0 +1,194 @@
+#include <new>
+#include <mutex>
+#include <cstring>
+
+#include "gc_telemetry.h"
+#include "state_alloc.h"
+
+namespace rostrum::gc {
+  namespace {
+    using namespace std::chrono;
+
+    constexpr auto kStateKey = "rostrum.gc";
+    constexpr auto kStateMetatable = "rostrum.gc.state";
+    constexpr auto kSentinelMetatable = "rostrum.gc.sentinel";
+
+    std::mutex defaults_mutex;
+    tuning defaults;
+
+    // userdata kept in registry
+    struct state_stats {
+      std::uint64_t cycles;
+      std::uint64_t explicit_steps;
+      std::uint64_t explicit_collections;
+      std::uint64_t explicit_step_ns_total;
+      std::uint64_t explicit_collection_ns_total;
+      std::array<std::uint64_t, kBuckets> explicit_step_histogram;
+      std::array<std::uint64_t, kBuckets> explicit_collection_histogram;
+      // set when the state is closed, as only then the registry lets go of the stats
+      bool closing;
+    };
+
+    state_stats* get_state(lua_State* L) {
+      lua_getfield(L, LUA_REGISTRYINDEX, kStateKey);
+      const auto s = static_cast<state_stats*>(lua_touserdata(L, -1));
+      lua_pop(L, 1);
+      return s;
+    }
+
+    std::size_t bucket(std::uint64_t ns) {
+      std::size_t result = 0;
+      while (ns > 1 && result < kBuckets - 1) {
+        ns >>= 1;
+        ++result;
+      }
+      return result;
+    }
+
+    void record_step(lua_State* L, const std::uint64_t ns) {
+      if (const auto s = get_state(L)) {
+        ++s->explicit_steps;
+        s->explicit_step_ns_total += ns;
+        ++s->explicit_step_histogram[bucket(ns)];
+      }
+    }
+
+    void record_full(lua_State* L, const std::uint64_t ns) {
+      if (const auto s = get_state(L)) {
+        ++s->explicit_collections;
+        s->explicit_collection_ns_total += ns;
+        ++s->explicit_collection_histogram[bucket(ns)];
+      }
+    }
+
+    std::uint64_t elapsed_ns(const steady_clock::time_point begin) {
+      return static_cast<std::uint64_t>(duration_cast<nanoseconds>(steady_clock::now() - begin).count());
+    }
+
+    void push_sentinel(lua_State* L) {
+      lua_newuserdata(L, 0);
+      luaL_getmetatable(L, kSentinelMetatable);
+      lua_setmetatable(L, -2);
+    }
+
+    int state_gc(lua_State* L) {
+      static_cast<state_stats*>(lua_touserdata(L, 1))->closing = true;
+      return 0;
+    }
+
+    // unreachable sentinel is finalized once per cycle and replaced by a new one, unless the state is being closed
+    int sentinel_gc(lua_State* L) {
+      const auto s = get_state(L);
+      if (s == nullptr || s->closing) {
+        return 0;
+      }
+      ++s->cycles;
+      push_sentinel(L);
+      lua_pop(L, 1);
+      return 0;
+    }
+
+    // collectgarbage of the base lib with timed "collect" and "step"
+    int timed_collectgarbage(lua_State* L) {
+      const auto option = luaL_optstring(L, 1, "collect");
+      const auto full = std::strcmp(option, "collect") == 0;
+      const auto step = std::strcmp(option, "step") == 0;
+
+      const auto n = lua_gettop(L);
+      lua_pushvalue(L, lua_upvalueindex(1));
+      lua_insert(L, 1);
+      const auto begin = steady_clock::now();
+      lua_call(L, n, LUA_MULTRET);
+      if (full) {
+        record_full(L, elapsed_ns(begin));
+      }
+      else if (step) {
+        record_step(L, elapsed_ns(begin));
+      }
+      return lua_gettop(L);
+    }
+  }
+
+  void set_defaults(const tuning& t) {
+    std::scoped_lock lock(defaults_mutex);
+    defaults = t;
+  }
+
+  void install(lua_State* L) {
+    const auto s = static_cast<state_stats*>(lua_newuserdata(L, sizeof(state_stats)));
+    new (s) state_stats{};
+    luaL_newmetatable(L, kStateMetatable);
+    lua_pushcfunction(L, state_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, kStateKey);
+
+    luaL_newmetatable(L, kSentinelMetatable);
+    lua_pushcfunction(L, sentinel_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+    push_sentinel(L);
+    lua_pop(L, 1);
+
+    lua_getglobal(L, "collectgarbage");
+    if (lua_isfunction(L, -1)) {
+      lua_pushcclosure(L, timed_collectgarbage, 1);
+      lua_setglobal(L, "collectgarbage");
+    }
+    else {
+      lua_pop(L, 1);
+    }
+
+    tuning t;
+    {
+      std::scoped_lock lock(defaults_mutex);
+      t = defaults;
+    }
+    tune(L, t);
+  }
+
+  tuning tune(lua_State* L, const tuning& t) {
+    tuning previous;
+    // setters return the previous value, so current one is written back when not changed
+    previous.pause = lua_gc(L, LUA_GCSETPAUSE, t.pause != 0 ? t.pause : 100);
+    if (t.pause == 0) {
+      lua_gc(L, LUA_GCSETPAUSE, previous.pause);
+    }
+    previous.stepmul = lua_gc(L, LUA_GCSETSTEPMUL, t.stepmul != 0 ? t.stepmul : 100);
+    if (t.stepmul == 0) {
+      lua_gc(L, LUA_GCSETSTEPMUL, previous.stepmul);
+    }
+    return previous;
+  }
+
+  bool step_budget(lua_State* L, const microseconds budget) {
+    const auto deadline = steady_clock::now() + budget;
+    auto finished = false;
+    do {
+      const auto begin = steady_clock::now();
+      // smallest step the collector does
+      finished = lua_gc(L, LUA_GCSTEP, 0) == 1;
+      record_step(L, elapsed_ns(begin));
+    } while (!finished && steady_clock::now() < deadline);
+    return finished;
+  }
+
+  stats get_stats(lua_State* L) {
+    stats result{};
+    result.heap_bytes = static_cast<std::size_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + static_cast<std::size_t>(lua_gc(L, LUA_GCCOUNTB, 0));
+    result.peak_heap_bytes = result.heap_bytes;
+    if (const auto a = alloc::get(L)) {
+      result.peak_heap_bytes = a->peak;
+    }
+    if (const auto s = get_state(L)) {
+      result.cycles = s->cycles;
+      result.explicit_steps = s->explicit_steps;
+      result.explicit_collections = s->explicit_collections;
+      result.explicit_step_ns_total = s->explicit_step_ns_total;
+      result.explicit_collection_ns_total = s->explicit_collection_ns_total;
+      result.explicit_step_histogram = s->explicit_step_histogram;
+      result.explicit_collection_histogram = s->explicit_collection_histogram;
+    }
+    return result;
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+#include "include/api.hpp"
+
+/*
+ * Garbage collector statistics and control of lua states.
+ * LuaJIT has no hooks around automatic collection steps, so cycles are counted by a finalizer sentinel
+ * and pauses are timed for collections run by the host or by scripts (collectgarbage, gc_step_budget).
+ */
+namespace rostrum::gc {
+
+  // bucket i counts pauses which took less than 2^(i+1) ns
+  constexpr std::size_t kBuckets = 40;
+
+  // 0 keeps lua default
+  struct tuning {
+    int pause = 0;
+    int stepmul = 0;
+  };
+
+  struct stats {
+    std::size_t heap_bytes;
+    std::size_t peak_heap_bytes;
+    // completed cycles, automatic ones included
+    std::uint64_t cycles;
+    // explicit_* cover only collections run by the host or scripts (collectgarbage, step_budget).
+    // automatic steps of the allocator are not timed
+    std::uint64_t explicit_steps;
+    std::uint64_t explicit_collections;
+    std::uint64_t explicit_step_ns_total;
+    std::uint64_t explicit_collection_ns_total;
+    std::array<std::uint64_t, kBuckets> explicit_step_histogram;
+    std::array<std::uint64_t, kBuckets> explicit_collection_histogram;
+  };
+
+  // tuning of states initialized afterwards
+  void set_defaults(const tuning& t);
+
+  // apply default tuning, start counting cycles and time collectgarbage. base lib must be open
+  void install(lua_State* L);
+
+  // returns previous tuning
+  tuning tune(lua_State* L, const tuning& t);
+
+  // incremental steps until @budget is used or the cycle is finished. returns true if it finished
+  bool step_budget(lua_State* L, std::chrono::microseconds budget);
+
+  [[nodiscard]]
+  stats get_stats(lua_State* L);
+}
@@ -1,6 +1,9 @@
 #pragma once
 #include <array>
 #include <cstdint>
+#include <utility>
+#include <string_view>
+#include <type_traits>
 
 #include <boost/dll.hpp>
 
@@ -30,7 +33,21 @@ namespace rostrum::api
 	using module_name = std::array<char, 12>;
 	using module_description = std::array<char, 52>;
 	
-	constexpr api_version kRostrumApiVersion = { 0,1 };
+	constexpr api_version kRostrumApiVersion = { 0,2 };
+
+	// function_entry flags
+	constexpr std::uint32_t kFunctionNone = 0;
+	// not wrapped by host instrumentation (e.g. function yields)
+	constexpr std::uint32_t kFunctionNoInstrument = 1 << 0;
+
+	/*
+	 * Native function registered by host in bulk (api 0.2).
+	 */
+	struct function_entry {
+		const char* name;
+		lua_CFunction function;
+		std::uint32_t flags;
+	};
 
 	class module_info {
 	public:
@@ -39,12 +56,20 @@ namespace rostrum::api
 		module_info() = default;
 		module_info(const module_name& name, const module_description& description, const module_version& version, imbue_lua_ptr imbue) :
 			apiVersion(kRostrumApiVersion), name(name), description(description), version(version), imbue(imbue) { }
+		template <std::size_t N>
+		module_info(const module_name& name, const module_description& description, const module_version& version, imbue_lua_ptr imbue, const std::array<function_entry, N>& functions) :
+			apiVersion(kRostrumApiVersion), name(name), description(description), version(version), imbue(imbue), functions(std::data(functions)), function_count(N) { }
 
 		api_version apiVersion;
 		module_name name;
 		module_description description;
 		module_version version;
 		imbue_lua_ptr * imbue;
+
+		// api 0.2. left untouched by 0.1 modules, so host resets them before query
+		// imbue may be null if module has only functions
+		const function_entry* functions = nullptr;
+		std::size_t function_count = 0;
 	};
 
 	using query_info_ptr = void(rostrum::api::module_info &) noexcept;
@@ -54,4 +79,85 @@ namespace rostrum::api
 			module_info_ptr = rostrum::api::module_info{ {name}, {description}, rostrum::api::module_version{version_major, version_minor}, imbue_ptr }; \
 		} \
 		BOOST_DLL_ALIAS(query_info, __rostrum_query_info)
-}
\ No newline at end of file
+
+	// @functions is a static constexpr std::array<rostrum::api::function_entry, N>. @imbue_ptr can be nullptr
+	#define DECLARE_MODULE_INTERFACE_V2(name, description, version_major, version_minor, imbue_ptr, functions) \
+		void query_info(rostrum::api::module_info& module_info_ptr) noexcept { \
+			module_info_ptr = rostrum::api::module_info{ {name}, {description}, rostrum::api::module_version{version_major, version_minor}, imbue_ptr, functions }; \
+		} \
+		BOOST_DLL_ALIAS(query_info, __rostrum_query_info)
+
+	/*
+	 * Fast bindings skip sol3 trampolines and argument checks.
+	 * Arguments are converted as lua_tonumber/lua_toboolean/lua_tolstring would, so wrong types are not reported.
+	 * Use for tiny hot functions which do not throw, safe bindings stay the default.
+	 *
+	 *   table.set("add", rostrum::api::fast<&add>);
+	 */
+	namespace details {
+		template <typename T>
+		T fast_get(lua_State* L, const int index) {
+			if constexpr (std::is_same_v<T, bool>) {
+				return lua_toboolean(L, index) != 0;
+			}
+			else if constexpr (std::is_integral_v<T>) {
+				return static_cast<T>(lua_tointeger(L, index));
+			}
+			else if constexpr (std::is_floating_point_v<T>) {
+				return static_cast<T>(lua_tonumber(L, index));
+			}
+			else if constexpr (std::is_same_v<T, std::string_view>) {
+				std::size_t len = 0;
+				const auto str = lua_tolstring(L, index, &len);
+				return str != nullptr ? std::string_view(str, len) : std::string_view{};
+			}
+			else if constexpr (std::is_same_v<T, const char*>) {
+				return lua_tostring(L, index);
+			}
+			else {
+				static_assert(sizeof(T) == 0, "fast bindings support arithmetic, bool and string arguments only");
+			}
+		}
+
+		template <typename T>
+		void fast_push(lua_State* L, const T value) {
+			if constexpr (std::is_same_v<T, bool>) {
+				lua_pushboolean(L, value);
+			}
+			else if constexpr (std::is_arithmetic_v<T>) {
+				lua_pushnumber(L, static_cast<lua_Number>(value));
+			}
+			else if constexpr (std::is_same_v<T, std::string_view>) {
+				lua_pushlstring(L, std::data(value), std::size(value));
+			}
+			else if constexpr (std::is_same_v<T, const char*>) {
+				lua_pushstring(L, value);
+			}
+			else {
+				static_assert(sizeof(T) == 0, "fast bindings support arithmetic, bool and string results only");
+			}
+		}
+
+		template <auto Fn, typename R, typename... Args, std::size_t... I>
+		int fast_call(lua_State* L, R(*)(Args...), std::index_sequence<I...>) {
+			if constexpr (std::is_void_v<R>) {
+				Fn(fast_get<std::decay_t<Args>>(L, static_cast<int>(I) + 1)...);
+				return 0;
+			}
+			else {
+				fast_push(L, Fn(fast_get<std::decay_t<Args>>(L, static_cast<int>(I) + 1)...));
+				return 1;
+			}
+		}
+
+		template <auto Fn, typename R, typename... Args>
+		int fast_call(lua_State* L, R(*fn)(Args...)) {
+			return fast_call<Fn>(L, fn, std::index_sequence_for<Args...>{});
+		}
+	}
+
+	template <auto Fn>
+	int fast(lua_State* L) {
+		return details::fast_call<Fn>(L, Fn);
+	}
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include <new>
+#include <atomic>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <string_view>
+
+#include "api.hpp"
+
+namespace rostrum::api
+{
+	/*
+	 * Owner of buffer memory. Plain function pointers keep it usable across modules built with different runtimes:
+	 * memory is always released by the code which allocated it.
+	 * Module must stay loaded while buffers it created are alive.
+	 */
+	struct buffer_owner {
+		void (*retain)(buffer_owner* self) noexcept;
+		void (*release)(buffer_owner* self) noexcept;
+	};
+
+	// registry name of buffer userdata metatable. registered by host in every state
+	constexpr const char* kBufferMetatable = "rostrum.buffer";
+
+	/*
+	 * Reference counted view of immutable bytes. Slices share the owner, so nothing is copied.
+	 * Layout is part of api: buffer userdata holds exactly this object.
+	 */
+	class buffer {
+	public:
+		buffer() noexcept = default;
+
+		// adopts one reference of @owner
+		buffer(const std::uint8_t* data, const std::size_t size, buffer_owner* owner) noexcept :
+			data_(data), size_(size), owner_(owner) { }
+
+		buffer(const buffer& other) noexcept : data_(other.data_), size_(other.size_), owner_(other.owner_) {
+			if (owner_ != nullptr) {
+				owner_->retain(owner_);
+			}
+		}
+
+		buffer(buffer&& other) noexcept :
+			data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)), owner_(std::exchange(other.owner_, nullptr)) { }
+
+		buffer& operator= (buffer other) noexcept {
+			std::swap(data_, other.data_);
+			std::swap(size_, other.size_);
+			std::swap(owner_, other.owner_);
+			return *this;
+		}
+
+		~buffer() {
+			if (owner_ != nullptr) {
+				owner_->release(owner_);
+			}
+		}
+
+		[[nodiscard]] const std::uint8_t* data() const noexcept { return data_; }
+		[[nodiscard]] std::size_t size() const noexcept { return size_; }
+		[[nodiscard]] bool empty() const noexcept { return size_ == 0; }
+
+		[[nodiscard]] std::string_view view() const noexcept {
+			return { reinterpret_cast<const char*>(data_), size_ };
+		}
+
+		// clamped to buffer bounds
+		[[nodiscard]] buffer slice(std::size_t offset, std::size_t length) const noexcept {
+			offset = offset < size_ ? offset : size_;
+			length = length < size_ - offset ? length : size_ - offset;
+			buffer result(*this);
+			result.data_ += offset;
+			result.size_ = length;
+			return result;
+		}
+
+		// take ownership of container with contiguous data() and size(), e.g. std::string or std::vector
+		template <typename Container>
+		[[nodiscard]] static buffer adopt(Container&& container);
+
+		[[nodiscard]] static buffer copy(const std::string_view bytes) {
+			return adopt(std::string(bytes));
+		}
+
+	private:
+		const std::uint8_t* data_ = nullptr;
+		std::size_t size_ = 0;
+		buffer_owner* owner_ = nullptr;
+	};
+
+	namespace details {
+		template <typename T>
+		struct heap_owner final : buffer_owner {
+			std::atomic<std::uint32_t> refs{ 1 };
+			T value;
+
+			explicit heap_owner(T&& v) : buffer_owner{ &retain_impl, &release_impl }, value(std::move(v)) { }
+
+			static void retain_impl(buffer_owner* self) noexcept {
+				static_cast<heap_owner*>(self)->refs.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			static void release_impl(buffer_owner* self) noexcept {
+				const auto owner = static_cast<heap_owner*>(self);
+				if (owner->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					delete owner;
+				}
+			}
+		};
+	}
+
+	template <typename Container>
+	buffer buffer::adopt(Container&& container) {
+		const auto owner = new details::heap_owner<std::decay_t<Container>>(std::forward<Container>(container));
+		const auto& value = owner->value;
+		return { reinterpret_cast<const std::uint8_t*>(std::data(value)), std::size(value) * sizeof(*std::data(value)), owner };
+	}
+
+	// returns nullptr if value at @index is not a buffer
+	inline buffer* to_buffer(lua_State* L, const int index) {
+		const auto p = lua_touserdata(L, index);
+		if (p == nullptr || !lua_getmetatable(L, index)) {
+			return nullptr;
+		}
+		luaL_getmetatable(L, kBufferMetatable);
+		const auto is_buffer = lua_rawequal(L, -1, -2) != 0;
+		lua_pop(L, 2);
+		return is_buffer ? static_cast<buffer*>(p) : nullptr;
+	}
+
+	inline void push_buffer(lua_State* L, buffer b) {
+		new (lua_newuserdata(L, sizeof(buffer))) buffer(std::move(b));
+		luaL_getmetatable(L, kBufferMetatable);
+		lua_setmetatable(L, -2);
+	}
+
+	// sol3 customization points, so bound functions can take and return buffers
+	inline int sol_lua_push(sol::types<buffer>, lua_State* L, const buffer& b) {
+		push_buffer(L, b);
+		return 1;
+	}
+
+	template <typename Handler>
+	bool sol_lua_check(sol::types<buffer>, lua_State* L, const int index, Handler&& handler, sol::stack::record& tracking) {
+		tracking.use(1);
+		if (to_buffer(L, index) == nullptr) {
+			handler(L, index, sol::type::userdata, sol::type_of(L, index), "expected rostrum.buffer");
+			return false;
+		}
+		return true;
+	}
+
+	inline buffer sol_lua_get(sol::types<buffer>, lua_State* L, const int index, sol::stack::record& tracking) {
+		tracking.use(1);
+		return *to_buffer(L, index);
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "api.hpp"
+#include "buffer.hpp"
+
+namespace rostrum::api
+{
+	struct completion_queue;
+
+	/*
+	 * Services host provides to modules for a lua state. Valid while the state is open.
+	 *
+	 *   // lua thread
+	 *   auto services = rostrum::api::get_services(L);
+	 *   const auto callback = rostrum::api::make_callback(L, 1);
+	 *   // any thread
+	 *   services->post(services->queue, callback, &payload);
+	 *
+	 * Script receives callback(payload) from core.poll or core.wait_completions.
+	 */
+	struct host_services {
+		api_version version;
+		completion_queue* queue;
+		// returns false if queue is full. on success @payload (may be null) is moved from
+		bool (*post)(completion_queue* queue, int callback, buffer* payload) noexcept;
+	};
+
+	// registry key of host_services userdata
+	constexpr const char* kHostServices = "rostrum.services";
+
+	inline host_services* get_services(lua_State* L) {
+		lua_getfield(L, LUA_REGISTRYINDEX, kHostServices);
+		const auto services = static_cast<host_services*>(lua_touserdata(L, -1));
+		lua_pop(L, 1);
+		return services;
+	}
+
+	// reference to function at @index. released by host when completion is delivered, so post it exactly once
+	inline int make_callback(lua_State* L, const int index) {
+		luaL_checktype(L, index, LUA_TFUNCTION);
+		lua_pushvalue(L, index);
+		return luaL_ref(L, LUA_REGISTRYINDEX);
+	}
+}
@@ -0,0 +1,106 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "binlog_format.h"
+
+/*
+ * Decoder of binary rostrum logs into "[%l] %v" text format of the text sink.
+ */
+namespace {
+  const char kUsage[] = "Usage: rostrum-logdecode <log.bin> [output.txt]";
+
+  template <typename T>
+  bool read_pod(std::istream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+  }
+
+  void read_string(std::istream& in, std::string& value) {
+    std::uint32_t length;
+    if (!read_pod(in, length)) {
+      throw std::runtime_error("truncated record");
+    }
+    value.resize(length);
+    if (!in.read(std::data(value), length)) {
+      throw std::runtime_error("truncated record");
+    }
+  }
+
+  void decode(std::istream& in, std::ostream& out) {
+    using namespace rostrum::binlog;
+
+    std::array<char, std::size(kMagic)> magic{};
+    if (!in.read(std::data(magic), std::size(magic)) || magic != kMagic) {
+      throw std::runtime_error("not a rostrum binary log");
+    }
+
+    std::unordered_map<std::uint32_t, std::string> sites;
+    std::string payload;
+    record_type type;
+    while (read_pod(in, type)) {
+      switch (type) {
+      case record_type::call_site: {
+        std::uint32_t id;
+        if (!read_pod(in, id)) {
+          throw std::runtime_error("truncated record");
+        }
+        read_string(in, sites[id]);
+        break;
+      }
+      case record_type::message: {
+        std::int64_t timestamp;
+        std::uint8_t level;
+        std::uint32_t site;
+        if (!read_pod(in, timestamp) || !read_pod(in, level) || !read_pod(in, site)) {
+          throw std::runtime_error("truncated record");
+        }
+        read_string(in, payload);
+
+        out << '[' << (level < std::size(kLevelNames) ? kLevelNames[level] : "unknown") << "] ";
+        if (site != kNoCallSite) {
+          const auto it = sites.find(site);
+          out << '[' << (it != std::end(sites) ? it->second : "?") << "] ";
+        }
+        out << payload << '\n';
+        break;
+      }
+      default:
+        throw std::runtime_error("unknown record type " + std::to_string(static_cast<int>(type)));
+      }
+    }
+  }
+}
+
+int main(const int argc, const char* const argv[]) {
+  if (argc < 2 || argc > 3) {
+    std::cerr << kUsage;
+    return EXIT_FAILURE;
+  }
+
+  try {
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in) {
+      throw std::runtime_error(std::string(argv[1]) + " not found");
+    }
+
+    if (argc == 3) {
+      std::ofstream out(argv[2]);
+      if (!out) {
+        throw std::runtime_error(std::string("cannot open ") + argv[2]);
+      }
+      decode(in, out);
+    }
+    else {
+      decode(in, std::cout);
+    }
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+  }
+
+  return EXIT_FAILURE;
+}
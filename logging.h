@@ -23,34 +23,211 @@
 #include <exception>
 #include <queue>
 #include <string_view>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <charconv>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+
+#include "binlog_format.h"
+#include "batched_file.h"
 
 namespace rostrum::logging {
 
+  enum class log_format {
+    text,
+    binary
+  };
+
+  [[nodiscard]]
+  inline log_format parse_log_format(const std::string_view name) {
+    if (name == "text") {
+      return log_format::text;
+    }
+    if (name == "binary") {
+      return log_format::binary;
+    }
+    throw std::invalid_argument("unsupported log format: " + std::string(name));
+  }
+
+  enum class log_writer {
+    direct,
+    batched
+  };
+
+  [[nodiscard]]
+  inline log_writer parse_log_writer(const std::string_view name) {
+    if (name == "direct") {
+      return log_writer::direct;
+    }
+    if (name == "batched") {
+      return log_writer::batched;
+    }
+    throw std::invalid_argument("unsupported log writer: " + std::string(name));
+  }
+
+  enum class overflow_policy {
+    block,
+    drop_oldest,
+    drop_newest
+  };
+
+  [[nodiscard]]
+  inline overflow_policy parse_overflow_policy(const std::string_view name) {
+    if (name == "block") {
+      return overflow_policy::block;
+    }
+    if (name == "drop_oldest") {
+      return overflow_policy::drop_oldest;
+    }
+    if (name == "drop_newest") {
+      return overflow_policy::drop_newest;
+    }
+    throw std::invalid_argument("unsupported log overflow policy: " + std::string(name));
+  }
+
+  struct options {
+    std::size_t queue_size = 8192;
+    std::size_t threads = 1;
+    overflow_policy overflow = overflow_policy::block;
+    log_format format = log_format::text;
+    log_writer writer = log_writer::direct;
+  };
+
+  struct statistics {
+    std::size_t queue_depth;
+    std::size_t queue_size;
+    std::uint64_t enqueued;
+    std::uint64_t dropped_newest;
+    std::uint64_t overrun_oldest;
+    std::uint64_t enqueue_ns_total;
+    std::uint64_t enqueue_ns_max;
+    std::uint64_t flushes;
+    std::uint64_t flush_ns_total;
+    std::uint64_t flush_ns_max;
+  };
+
   namespace detail {
 
+    struct counters {
+      std::atomic<std::uint64_t> enqueued{ 0 };
+      std::atomic<std::uint64_t> dropped_newest{ 0 };
+      std::atomic<std::uint64_t> enqueue_ns_total{ 0 };
+      std::atomic<std::uint64_t> enqueue_ns_max{ 0 };
+      std::atomic<std::uint64_t> flushes{ 0 };
+      std::atomic<std::uint64_t> flush_ns_total{ 0 };
+      std::atomic<std::uint64_t> flush_ns_max{ 0 };
+    };
+    inline counters counters_;
+
+    // capacity of active log queue
+    inline std::atomic<std::size_t> queue_size_{ 0 };
+
+    inline std::uint64_t elapsed_ns(const std::chrono::steady_clock::time_point begin) {
+      using namespace std::chrono;
+      return static_cast<std::uint64_t>(duration_cast<nanoseconds>(steady_clock::now() - begin).count());
+    }
+
+    inline void record(std::atomic<std::uint64_t>& total, std::atomic<std::uint64_t>& max, const std::uint64_t value) {
+      total.fetch_add(value, std::memory_order_relaxed);
+      auto current = max.load(std::memory_order_relaxed);
+      while (current < value && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+      }
+    }
+
+    /*
+     * Sink which log file can be moved while logging.
+     */
+    class rerouteable_sink {
+    public:
+      virtual ~rerouteable_sink() = default;
+      virtual void rename(const std::string& filename) = 0;
+    };
+
     /*
-     * Sink for writing to temp file until renamed.
+     * Sink which log file can be synced to disk.
+     * Sync is done on the next flush, so records logged before request_sync are synced too.
      */
-    template<typename Mutex>
-    class temp_file_sink final : public spdlog::sinks::base_sink<Mutex> {
+    class syncable_sink {
     public:
-      temp_file_sink();
+      virtual ~syncable_sink() = default;
+      [[nodiscard]] virtual std::uint64_t request_sync() = 0;
+      [[nodiscard]] virtual bool wait_synced(std::uint64_t ticket, std::chrono::milliseconds timeout) = 0;
+    };
+
+    // file_helper has no access to the descriptor, so only stdio buffers are flushed
+    inline void sync_file(spdlog::details::file_helper& file) {
+      file.flush();
+    }
+
+    inline void sync_file(batched_file& file) {
+      file.sync();
+    }
+
+    /*
+     * Base for sinks writing to temp file until renamed.
+     */
+    template<typename Mutex, typename File>
+    class temp_file_sink_base : public spdlog::sinks::base_sink<Mutex>, public rerouteable_sink, public syncable_sink {
+    public:
+      temp_file_sink_base();
       [[nodiscard]] const spdlog::filename_t& filename() const;
-      void rename(const std::string& filename);
+      void rename(const std::string& filename) override;
+      [[nodiscard]] std::uint64_t request_sync() override;
+      [[nodiscard]] bool wait_synced(std::uint64_t ticket, std::chrono::milliseconds timeout) override;
 
     protected:
-      void sink_it_(const spdlog::details::log_msg& msg) override;
       void flush_() override;
 
+      File file_helper_;
+
+    private:
+      std::atomic<std::uint64_t> sync_requested_{ 0 };
+      std::uint64_t synced_{ 0 };
+      std::mutex sync_mutex_;
+      std::condition_variable sync_cv_;
+    };
+
+    /*
+     * Sink for writing formatted text to temp file until renamed.
+     */
+    template<typename Mutex, typename File = spdlog::details::file_helper>
+    class temp_file_sink final : public temp_file_sink_base<Mutex, File> {
+    protected:
+      void sink_it_(const spdlog::details::log_msg& msg) override;
+    };
+
+    /*
+     * Sink for writing binary records (see binlog_format.h) to temp file until renamed.
+     * Call site strings are written once per file and referenced by id.
+     */
+    template<typename Mutex, typename File = spdlog::details::file_helper>
+    class binary_file_sink final : public temp_file_sink_base<Mutex, File> {
+    public:
+      binary_file_sink();
+
+    protected:
+      void sink_it_(const spdlog::details::log_msg& msg) override;
+
     private:
-      spdlog::details::file_helper file_helper_;
+      // call site strings are interned, so pointer identifies the site
+      std::unordered_map<const char*, std::uint32_t> sites_;
     };
 
     using temp_file_sink_mt = temp_file_sink<std::mutex>;
     using temp_file_sink_st = temp_file_sink<spdlog::details::null_mutex>;
+    using binary_file_sink_mt = binary_file_sink<std::mutex>;
+    using binary_file_sink_st = binary_file_sink<spdlog::details::null_mutex>;
+    using batched_temp_file_sink_mt = temp_file_sink<std::mutex, batched_file>;
+    using batched_binary_file_sink_mt = binary_file_sink<std::mutex, batched_file>;
 
-    template<typename Mutex>
-    temp_file_sink<Mutex>::temp_file_sink() {
+    template<typename Mutex, typename File>
+    temp_file_sink_base<Mutex, File>::temp_file_sink_base() {
 #if defined(__STDC_LIB_EXT1__) || defined(_MSC_VER)
       char filename[MAX_PATH];
       if (tmpnam_s(filename, MAX_PATH) != 0) {
@@ -63,15 +240,15 @@ namespace rostrum::logging {
       file_helper_.open(filename);
     }
 
-    template<typename Mutex>
-    const spdlog::filename_t& temp_file_sink<Mutex>::filename() const {
-      std::scoped_lock(mutex_);
+    template<typename Mutex, typename File>
+    const spdlog::filename_t& temp_file_sink_base<Mutex, File>::filename() const {
+      std::scoped_lock lock(this->mutex_);
       return file_helper_.filename();
     }
 
-    template <typename Mutex>
-    void temp_file_sink<Mutex>::rename(const std::string& filename) {
-      std::scoped_lock(mutex_);
+    template<typename Mutex, typename File>
+    void temp_file_sink_base<Mutex, File>::rename(const std::string& filename) {
+      std::scoped_lock lock(this->mutex_);
 
       file_helper_.flush();
       file_helper_.close();
@@ -83,22 +260,361 @@ namespace rostrum::logging {
       file_helper_.open(filename);
     }
 
-    template<typename Mutex>
-    void temp_file_sink<Mutex>::sink_it_(const spdlog::details::log_msg& msg) {
-      std::scoped_lock(mutex_);
+    template<typename Mutex, typename File>
+    std::uint64_t temp_file_sink_base<Mutex, File>::request_sync() {
+      return sync_requested_.fetch_add(1, std::memory_order_acq_rel) + 1;
+    }
+
+    template<typename Mutex, typename File>
+    bool temp_file_sink_base<Mutex, File>::wait_synced(const std::uint64_t ticket, const std::chrono::milliseconds timeout) {
+      std::unique_lock lock(sync_mutex_);
+      return sync_cv_.wait_for(lock, timeout, [this, ticket] { return synced_ >= ticket; });
+    }
+
+    template<typename Mutex, typename File>
+    void temp_file_sink_base<Mutex, File>::flush_() {
+      const auto begin = std::chrono::steady_clock::now();
+
+      const auto requested = sync_requested_.load(std::memory_order_acquire);
+      if (requested != 0 && requested != synced_) {
+        sync_file(file_helper_);
+        {
+          std::scoped_lock lock(sync_mutex_);
+          synced_ = requested;
+        }
+        sync_cv_.notify_all();
+      }
+      else {
+        file_helper_.flush();
+      }
 
+      counters_.flushes.fetch_add(1, std::memory_order_relaxed);
+      record(counters_.flush_ns_total, counters_.flush_ns_max, elapsed_ns(begin));
+    }
+
+    // base_sink holds the mutex while sink_it_ is called
+    template<typename Mutex, typename File>
+    void temp_file_sink<Mutex, File>::sink_it_(const spdlog::details::log_msg& msg) {
       spdlog::memory_buf_t formatted;
       spdlog::sinks::base_sink<Mutex>::formatter_->format(msg, formatted);
-      file_helper_.write(formatted);
+      this->file_helper_.write(formatted);
     }
 
-    template<typename Mutex>
-    void temp_file_sink<Mutex>::flush_() {
-      file_helper_.flush();
+    template<typename Mutex, typename File>
+    binary_file_sink<Mutex, File>::binary_file_sink() {
+      spdlog::memory_buf_t header;
+      header.append(std::data(binlog::kMagic), std::data(binlog::kMagic) + std::size(binlog::kMagic));
+      this->file_helper_.write(header);
+    }
+
+    template<typename Mutex, typename File>
+    void binary_file_sink<Mutex, File>::sink_it_(const spdlog::details::log_msg& msg) {
+      spdlog::memory_buf_t buffer;
+
+      std::uint32_t site = binlog::kNoCallSite;
+      if (!msg.source.empty()) {
+        const auto [it, inserted] = sites_.try_emplace(msg.source.filename, static_cast<std::uint32_t>(std::size(sites_) + 1));
+        site = it->second;
+        if (inserted) {
+          binlog::append_call_site(buffer, site, msg.source.filename);
+        }
+      }
+
+      const auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(msg.time.time_since_epoch()).count();
+      binlog::append_message(buffer, timestamp, static_cast<std::uint8_t>(msg.level), site, std::string_view(std::data(msg.payload), std::size(msg.payload)));
+      this->file_helper_.write(buffer);
     }
 
+    /*
+     * Formatter flag printing "[src:name:line] " of lua call sites.
+     * Empty for host messages
+     */
+    class call_site_flag final : public spdlog::custom_flag_formatter {
+    public:
+      void format(const spdlog::details::log_msg& msg, const std::tm&, spdlog::memory_buf_t& dest) override {
+        if (msg.source.empty()) {
+          return;
+        }
+        const std::string_view site = msg.source.filename;
+        dest.push_back('[');
+        dest.append(std::data(site), std::data(site) + std::size(site));
+        dest.push_back(']');
+        dest.push_back(' ');
+      }
+
+      [[nodiscard]] std::unique_ptr<custom_flag_formatter> clone() const override {
+        return spdlog::details::make_unique<call_site_flag>();
+      }
+    };
+
+    /*
+     * Sink forwarding records to callbacks of the threads which logged them, e.g. to clients of served scripts.
+     * Records of threads without route are skipped.
+     * A route is synced by a sentinel record of its thread, which is queued after the records logged before it.
+     */
+    class routing_sink final : public spdlog::sinks::base_sink<std::mutex> {
+    public:
+      using route = std::function<void(spdlog::level::level_enum level, std::string_view formatted)>;
+
+      // source of sentinel records. payload is the ticket
+      inline static const char kSyncSource[] = "rostrum.route.sync";
+
+      routing_sink() {
+        auto formatter = std::make_unique<spdlog::pattern_formatter>();
+        formatter->add_flag<call_site_flag>('*').set_pattern("[%l] %*%v");
+        set_formatter_(std::move(formatter));
+      }
+
+      void add(const std::size_t thread, route r) {
+        std::scoped_lock lock(routes_mutex_);
+        routes_[thread] = { std::make_shared<route>(std::move(r)), 0 };
+        has_routes_.store(true, std::memory_order_release);
+      }
+
+      void remove(const std::size_t thread) {
+        std::scoped_lock lock(routes_mutex_);
+        routes_.erase(thread);
+        has_routes_.store(!routes_.empty(), std::memory_order_release);
+      }
+
+      [[nodiscard]] std::uint64_t next_ticket() {
+        return tickets_.fetch_add(1, std::memory_order_relaxed) + 1;
+      }
+
+      // wait until sentinel with @ticket of @thread is sunk
+      [[nodiscard]] bool wait_synced(const std::size_t thread, const std::uint64_t ticket, const std::chrono::milliseconds timeout) {
+        std::unique_lock lock(routes_mutex_);
+        return sync_cv_.wait_for(lock, timeout, [&] {
+          const auto it = routes_.find(thread);
+          return it == std::end(routes_) || it->second.synced >= ticket;
+        });
+      }
+
+    protected:
+      void sink_it_(const spdlog::details::log_msg& msg) override {
+        if (!has_routes_.load(std::memory_order_acquire)) {
+          return;
+        }
+
+        if (msg.source.filename == kSyncSource) {
+          std::uint64_t ticket = 0;
+          std::from_chars(std::data(msg.payload), std::data(msg.payload) + std::size(msg.payload), ticket);
+          {
+            std::scoped_lock lock(routes_mutex_);
+            if (const auto it = routes_.find(msg.thread_id); it != std::end(routes_)) {
+              it->second.synced = (std::max)(it->second.synced, ticket);
+            }
+          }
+          sync_cv_.notify_all();
+          return;
+        }
+
+        std::shared_ptr<route> r;
+        {
+          std::scoped_lock lock(routes_mutex_);
+          const auto it = routes_.find(msg.thread_id);
+          if (it == std::end(routes_)) {
+            return;
+          }
+          r = it->second.callback;
+        }
+
+        spdlog::memory_buf_t formatted;
+        formatter_->format(msg, formatted);
+        (*r)(msg.level, std::string_view(std::data(formatted), std::size(formatted)));
+      }
+
+      void flush_() override {
+      }
+
+    private:
+      struct entry {
+        std::shared_ptr<route> callback;
+        // last sunk sentinel
+        std::uint64_t synced;
+      };
+
+      std::atomic<bool> has_routes_{ false };
+      std::mutex routes_mutex_;
+      std::condition_variable sync_cv_;
+      std::unordered_map<std::size_t, entry> routes_;
+      std::atomic<std::uint64_t> tickets_{ 0 };
+    };
+
+    // shared by default logger instances, so routes survive reconfigure
+    inline const auto routing_sink_ = std::make_shared<routing_sink>();
+
+    // last sink of a drop_newest logger. releases queue slot once the record is sunk
+    class slot_release_sink final : public spdlog::sinks::base_sink<spdlog::details::null_mutex> {
+    public:
+      std::atomic<std::size_t> pending{ 0 };
+
+    protected:
+      void sink_it_(const spdlog::details::log_msg&) override {
+        pending.fetch_sub(1, std::memory_order_release);
+      }
+
+      void flush_() override {
+      }
+    };
+
+    /*
+     * Front of the async logger which counts enqueued records.
+     * With drop_newest policy it never blocks on full queue: a slot is reserved
+     * before the record is posted, so concurrent callers cannot overfill the queue
+     * and records over capacity are dropped.
+     * Sinks are shared with the async backend and only written by its thread pool.
+     */
+    class accounting_logger final : public spdlog::logger {
+    public:
+      accounting_logger(std::string name, const std::vector<spdlog::sink_ptr>& sinks, std::weak_ptr<spdlog::details::thread_pool> pool, const overflow_policy policy, const std::size_t capacity)
+        : logger(name, sinks.begin(), sinks.end()), capacity_(capacity) {
+        auto backend_sinks = sinks;
+        if (policy == overflow_policy::drop_newest) {
+          slots_ = std::make_shared<slot_release_sink>();
+          backend_sinks.push_back(slots_);
+        }
+        const auto overflow = policy == overflow_policy::drop_oldest ? spdlog::async_overflow_policy::overrun_oldest : spdlog::async_overflow_policy::block;
+        backend_ = std::make_shared<spdlog::async_logger>(name, backend_sinks.begin(), backend_sinks.end(), pool, overflow);
+        // level is filtered by front
+        backend_->set_level(spdlog::level::trace);
+        // same queue, so sentinels follow records logged before them
+        sync_ = std::make_shared<spdlog::async_logger>(name + ".sync", routing_sink_, std::move(pool), spdlog::async_overflow_policy::block);
+        sync_->set_level(spdlog::level::trace);
+      }
+
+      // queue sentinel of calling thread for routing sink. with more than one pool thread records may be reordered
+      void sync_route(const std::uint64_t ticket) {
+        const auto payload = std::to_string(ticket);
+        sync_->log(spdlog::source_loc{ routing_sink::kSyncSource, 1, "" }, spdlog::level::critical, payload);
+      }
+
+    protected:
+      void sink_it_(const spdlog::details::log_msg& msg) override {
+        if (slots_ && slots_->pending.fetch_add(1, std::memory_order_acquire) >= capacity_) {
+          slots_->pending.fetch_sub(1, std::memory_order_relaxed);
+          counters_.dropped_newest.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+
+        // backend captures the same thread id, so routes still match
+        backend_->log(msg.time, msg.source, msg.level, msg.payload);
+        counters_.enqueued.fetch_add(1, std::memory_order_relaxed);
+        // flush_on level is kept by front, e.g. errors are flushed once logged
+        if (should_flush_(msg)) {
+          flush_();
+        }
+      }
+
+      void flush_() override {
+        backend_->flush();
+      }
+
+    private:
+      const std::size_t capacity_;
+      std::shared_ptr<slot_release_sink> slots_;
+      std::shared_ptr<spdlog::async_logger> backend_;
+      std::shared_ptr<spdlog::async_logger> sync_;
+    };
+
+    // "src:name:line" strings live until exit so log records can point to them
+    inline const char* intern_call_site(const std::string_view site) {
+      static std::mutex mutex;
+      static std::unordered_set<std::string> sites;
+
+      std::scoped_lock lock(mutex);
+      return sites.emplace(site).first->c_str();
+    }
+  }
+
+  /*
+   * Log through async logger with backpressure accounting.
+   * With drop_newest policy the logger drops the message if the queue is full.
+   */
+  inline void log(spdlog::logger& logger, const spdlog::source_loc& location, const spdlog::level::level_enum level, const spdlog::string_view_t msg) {
+    using namespace detail;
+
+    const auto begin = std::chrono::steady_clock::now();
+    logger.log(location, level, msg);
+    record(counters_.enqueue_ns_total, counters_.enqueue_ns_max, elapsed_ns(begin));
+  }
+
+  [[nodiscard]]
+  inline statistics get_statistics() {
+    using namespace detail;
+
+    const auto pool = spdlog::thread_pool();
+    return {
+      pool ? pool->queue_size() : 0,
+      queue_size_.load(std::memory_order_relaxed),
+      counters_.enqueued.load(std::memory_order_relaxed),
+      counters_.dropped_newest.load(std::memory_order_relaxed),
+      pool ? pool->overrun_counter() : 0,
+      counters_.enqueue_ns_total.load(std::memory_order_relaxed),
+      counters_.enqueue_ns_max.load(std::memory_order_relaxed),
+      counters_.flushes.load(std::memory_order_relaxed),
+      counters_.flush_ns_total.load(std::memory_order_relaxed),
+      counters_.flush_ns_max.load(std::memory_order_relaxed)
+    };
+  }
+
+  /*
+   * Durability point: wait until records logged so far are synced to disk by file sinks.
+   * Flush is re-posted since the flush message can be overrun with drop_oldest policy.
+   */
+  inline bool sync(spdlog::logger& logger, const std::chrono::milliseconds timeout) {
+    using namespace std::chrono;
+
+    const auto deadline = steady_clock::now() + timeout;
+    for (const auto& sink : logger.sinks()) {
+      const auto syncable = std::dynamic_pointer_cast<detail::syncable_sink>(sink);
+      if (!syncable) {
+        continue;
+      }
+
+      const auto ticket = syncable->request_sync();
+      auto synced = false;
+      while (!synced && steady_clock::now() < deadline) {
+        logger.flush();
+        const auto left = duration_cast<milliseconds>(deadline - steady_clock::now());
+        synced = syncable->wait_synced(ticket, (std::min)(left, milliseconds(100)));
+      }
+      if (!synced) {
+        return false;
+      }
+    }
+    return true;
   }
 
+  /*
+   * Routes records logged by the current thread to @route, in addition to the regular sinks, until destroyed.
+   * Records still queued in the async logger are delivered before the route is removed.
+   */
+  class scoped_log_route final {
+  public:
+    explicit scoped_log_route(detail::routing_sink::route route) : thread_(spdlog::details::os::thread_id()) {
+      detail::routing_sink_->add(thread_, std::move(route));
+    }
+
+    scoped_log_route(const scoped_log_route&) = delete;
+    scoped_log_route& operator= (const scoped_log_route&) = delete;
+
+    ~scoped_log_route() {
+      using namespace std::chrono;
+
+      // records logged before are forwarded once the sentinel of this thread is sunk
+      if (const auto logger = std::dynamic_pointer_cast<detail::accounting_logger>(spdlog::default_logger())) {
+        const auto ticket = detail::routing_sink_->next_ticket();
+        logger->sync_route(ticket);
+        [[maybe_unused]] const auto synced = detail::routing_sink_->wait_synced(thread_, ticket, seconds(5));
+      }
+      detail::routing_sink_->remove(thread_);
+    }
+
+  private:
+    std::size_t thread_;
+  };
+
   class logger_guard final {
   public:
     logger_guard(const logger_guard&) = delete;
@@ -108,6 +624,12 @@ namespace rostrum::logging {
 
   private:
     inline static std::once_flag init_flag_;
+    inline static std::mutex reconfigure_mutex_;
+    inline static options options_;
+
+    // loggers replaced by reconfigure. other threads may still hold raw pointers to them.
+    // their thread pools are drained and joined on reconfigure
+    inline static std::vector<std::shared_ptr<spdlog::logger>> retired_;
 
     static void invoke_deferred_destruction() {
       struct deferred_destructor final {
@@ -141,11 +663,26 @@ namespace rostrum::logging {
       return sinks;
     }
 
-    static void initialize_once() {
+    static void create_default_logger(const options& opts, const std::vector<spdlog::sink_ptr>& sinks, const spdlog::level::level_enum level) {
+      spdlog::init_thread_pool(opts.queue_size, opts.threads);
+
+      const auto logger = std::make_shared<detail::accounting_logger>("default", sinks, spdlog::thread_pool(), opts.overflow, opts.queue_size);
+      logger->set_level(level);
+      logger->flush_on(spdlog::level::err);
+      auto formatter = std::make_unique<spdlog::pattern_formatter>();
+      formatter->add_flag<detail::call_site_flag>('*').set_pattern("[%^%l%$] %*%v");
+      logger->set_formatter(std::move(formatter));
+      register_logger(logger);
+      set_default_logger(logger);
+
+      options_ = opts;
+      detail::queue_size_ = opts.queue_size;
+    }
+
+    static void initialize_once(const options& opts) {
       try
       {
         spdlog::drop_all();
-        spdlog::init_thread_pool(8192, 1);
 
         // default logger
         {
@@ -154,15 +691,20 @@ namespace rostrum::logging {
           console_sink->set_color(spdlog::level::trace, console_sink->BOLD);
           console_sink->set_color(spdlog::level::warn,  console_sink->YELLOW);
 
-          const auto file_sink = std::make_shared<detail::temp_file_sink_mt>();
-          std::vector<spdlog::sink_ptr> sinks{ console_sink , file_sink };
+          spdlog::sink_ptr file_sink;
+          if (opts.format == log_format::binary) {
+            file_sink = opts.writer == log_writer::batched
+              ? spdlog::sink_ptr(std::make_shared<detail::batched_binary_file_sink_mt>())
+              : spdlog::sink_ptr(std::make_shared<detail::binary_file_sink_mt>());
+          }
+          else {
+            file_sink = opts.writer == log_writer::batched
+              ? spdlog::sink_ptr(std::make_shared<detail::batched_temp_file_sink_mt>())
+              : spdlog::sink_ptr(std::make_shared<detail::temp_file_sink_mt>());
+          }
+          std::vector<spdlog::sink_ptr> sinks{ console_sink , file_sink, detail::routing_sink_ };
 
-          const auto logger = std::make_shared<spdlog::async_logger>("default", sinks.begin(), sinks.end(), spdlog::thread_pool());
-          logger->set_level(spdlog::level::trace);
-          logger->flush_on(spdlog::level::err);
-          logger->set_pattern("[%^%l%$] %v");
-          register_logger(logger);
-          set_default_logger(logger);
+          create_default_logger(opts, sinks, spdlog::level::trace);
           spdlog::info("default logger set up");
         }
 
@@ -184,8 +726,35 @@ namespace rostrum::logging {
     }
 
   public:
-    logger_guard() {
-      std::call_once(init_flag_, initialize_once);
+    [[nodiscard]]
+    static options get_options() {
+      std::scoped_lock lock(reconfigure_mutex_);
+      return options_;
+    }
+
+    // recreate default logger with new queue. sinks and level are kept
+    static void reconfigure(const options& opts) {
+      if (opts.queue_size == 0 || opts.threads == 0) {
+        throw std::invalid_argument("log queue size and thread count must be positive");
+      }
+
+      std::scoped_lock lock(reconfigure_mutex_);
+
+      const auto old = spdlog::get("default");
+      auto old_pool = spdlog::thread_pool();
+      old->flush();
+      retired_.push_back(old);
+
+      spdlog::drop("default");
+      create_default_logger(opts, old->sinks(), old->level());
+
+      // old logger keeps only a weak reference. pool destructor sinks queued records and joins its threads
+      old_pool.reset();
+      spdlog::debug("default logger reconfigured: queue size {}, {} threads", opts.queue_size, opts.threads);
+    }
+
+    explicit logger_guard(const options& opts = {}) {
+      std::call_once(init_flag_, initialize_once, opts);
     }
 
     ~logger_guard() {
@@ -0,0 +1,104 @@
+#include <spdlog/spdlog.h>
+
+#include "lua_buffer.h"
+#include "mapped_file.h"
+
+namespace rostrum::lua_buffer {
+  namespace {
+    api::buffer& check(lua_State* L, const int index) {
+      return *static_cast<api::buffer*>(luaL_checkudata(L, index, api::kBufferMetatable));
+    }
+
+    // string.sub rules: 1-based, inclusive, negative indices count from the end
+    std::size_t relative_index(const lua_Integer index, const std::size_t size) {
+      if (index >= 0) {
+        return static_cast<std::size_t>(index);
+      }
+      const auto from_end = static_cast<std::size_t>(-index);
+      return from_end > size ? 0 : size - from_end + 1;
+    }
+
+    int gc(lua_State* L) {
+      check(L, 1).~buffer();
+      return 0;
+    }
+
+    int size(lua_State* L) {
+      lua_pushnumber(L, static_cast<lua_Number>(check(L, 1).size()));
+      return 1;
+    }
+
+    int sub(lua_State* L) {
+      const auto& b = check(L, 1);
+      auto first = relative_index(luaL_optinteger(L, 2, 1), b.size());
+      const auto last = (std::min)(relative_index(luaL_optinteger(L, 3, -1), b.size()), b.size());
+      first = (std::max)(first, std::size_t{ 1 });
+      api::push_buffer(L, first > last ? api::buffer{} : b.slice(first - 1, last - first + 1));
+      return 1;
+    }
+
+    int byte(lua_State* L) {
+      const auto& b = check(L, 1);
+      const auto i = relative_index(luaL_optinteger(L, 2, 1), b.size());
+      if (i == 0 || i > b.size()) {
+        return 0;
+      }
+      lua_pushinteger(L, b.data()[i - 1]);
+      return 1;
+    }
+
+    // for ffi.cast("const uint8_t*", buf:ptr()). buffer must be kept alive while pointer is used
+    int ptr(lua_State* L) {
+      lua_pushlightuserdata(L, const_cast<std::uint8_t*>(check(L, 1).data()));
+      return 1;
+    }
+
+    int tostring(lua_State* L) {
+      const auto view = check(L, 1).view();
+      lua_pushlstring(L, std::data(view), std::size(view));
+      return 1;
+    }
+
+    const luaL_Reg methods[] = {
+      { "size", size },
+      { "sub", sub },
+      { "byte", byte },
+      { "ptr", ptr },
+      { "tostring", tostring },
+      { nullptr, nullptr }
+    };
+  }
+
+  void register_type(lua_State* L) {
+    if (luaL_newmetatable(L, api::kBufferMetatable) == 0) {
+      lua_pop(L, 1);
+      return;
+    }
+
+    lua_pushcfunction(L, gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcfunction(L, size);
+    lua_setfield(L, -2, "__len");
+    lua_pushcfunction(L, tostring);
+    lua_setfield(L, -2, "__tostring");
+
+    lua_newtable(L);
+    luaL_register(L, nullptr, methods);
+    lua_setfield(L, -2, "__index");
+
+    // hide metatable from scripts
+    lua_pushboolean(L, 0);
+    lua_setfield(L, -2, "__metatable");
+
+    lua_pop(L, 1);
+  }
+
+  api::buffer map_file(const std::string& filename) {
+    mapped_file file(filename);
+    if (file.size() == 0) {
+      return {};
+    }
+    spdlog::debug("mapped '{}' into buffer ({} bytes)", filename, file.size());
+    return api::buffer::adopt(std::move(file));
+  }
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <string>
+
+#include "include/buffer.hpp"
+
+namespace rostrum::lua_buffer {
+
+  // register buffer metatable in the state. methods: size, sub, byte, ptr, tostring
+  void register_type(lua_State* L);
+
+  // read-only memory mapped file. empty files give empty buffer
+  [[nodiscard]]
+  api::buffer map_file(const std::string& filename);
+}
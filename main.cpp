@@ -1,43 +1,158 @@
 #include <iostream>
 #include <string>
+#include <thread>
+#include <algorithm>
 
 #include "exceptions.h"
 #include "manager.h"
 #include "sol_check.h"
 #include "logging.h"
+#include "script_loader.h"
+#include "cli.h"
+#include "metrics.h"
+#include "memprofile.h"
+#include "serve.h"
+#include "batch.h"
 
-const char kUsage[] = "Usage: rostrum-host <script.rlua> [args]";
+namespace {
+  // metrics are written whether script succeeded or not
+  struct metrics_guard final {
+    const std::string& path;
+
+    ~metrics_guard() {
+      if (path.empty()) {
+        return;
+      }
+      try {
+        rostrum::metrics::write_json(path);
+      }
+      catch (const std::exception& e) {
+        spdlog::warn("failed to write metrics: {}", e.what());
+      }
+    }
+  };
+
+  // canary runs write the memory profile even if script failed
+  struct memprofile_guard final {
+    const std::string& path;
+    lua_State* L;
+
+    ~memprofile_guard() {
+      if (path.empty() || !rostrum::memprofile::running(L)) {
+        return;
+      }
+      try {
+        rostrum::memprofile::stop(L, path, 20);
+      }
+      catch (const std::exception& e) {
+        spdlog::warn("failed to write memory profile: {}", e.what());
+      }
+    }
+  };
+}
 
 int main(const int argc, const char* const argv[]) {
+  // parse args
+  rostrum::cli::options options;
+  try {
+    options = rostrum::cli::parse(argc, argv);
+  }
+  catch (const std::invalid_argument& e) {
+    std::cerr << e.what() << '\n' << rostrum::cli::kUsage;
+    return EXIT_FAILURE;
+  }
+
+  // thin client. logs come from the server
+  if (!options.connect_socket.empty()) {
+    if (options.script.empty()) {
+      std::cerr << rostrum::cli::kUsage;
+      return EXIT_FAILURE;
+    }
+    try {
+      return rostrum::serve::run_client(options.connect_socket, { options.script, options.script_args });
+    }
+    catch (const std::exception& e) {
+      std::cerr << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  }
+
   try {
-    [[maybe_unused]] volatile rostrum::logging::logger_guard logger_guard;
+    [[maybe_unused]] volatile rostrum::logging::logger_guard logger_guard(options.logging);
     // system exceptions guard
     [[maybe_unused]] volatile rostrum::except::scoped_exception_guard exception_guard;
-    if (argc < 2) {
-      std::cerr << kUsage;
+    rostrum::budget::set_defaults(options.budget);
+    rostrum::gc::set_defaults(options.gc);
+
+    if (!options.serve_socket.empty()) {
+      if (options.metrics) {
+        rostrum::metrics::enable();
+      }
+      [[maybe_unused]] const metrics_guard metrics_guard{ options.metrics_path };
+
+      auto& manager = rostrum::manager::get_instance();
+      if (options.watch_modules) {
+        manager.watch_modules();
+      }
+      manager.reload_rostrum_modules();
+
+      const auto workers = options.serve_workers != 0 ? options.serve_workers : (std::max)(1u, std::thread::hardware_concurrency());
+      rostrum::serve::run_server(options.serve_socket, workers);
+      return EXIT_SUCCESS;
+    }
+
+    if (!options.batch_manifest.empty()) {
+      if (options.metrics) {
+        rostrum::metrics::enable();
+      }
+      [[maybe_unused]] const metrics_guard metrics_guard{ options.metrics_path };
+
+      // one set of loaded modules shared by all job states
+      rostrum::manager::get_instance().reload_rostrum_modules();
+
+      const auto threads = options.batch_threads != 0 ? options.batch_threads : (std::max)(1u, std::thread::hardware_concurrency());
+      const auto summary = rostrum::batch::run({ options.batch_manifest, threads, options.batch_log_dir });
+      return summary.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (options.script.empty()) {
+      std::cerr << rostrum::cli::kUsage;
       return EXIT_FAILURE;
     }
 
-    // parse args
-    const std::string script_name = argv[1];
-    std::vector<std::string> script_args;
-    for (auto i = 2; i < argc; ++i) {
-      script_args.emplace_back(argv[i]);
+    const auto& script_name = options.script;
+    const auto& script_args = options.script_args;
+
+    if (options.metrics) {
+      rostrum::metrics::enable();
     }
+    [[maybe_unused]] const metrics_guard metrics_guard{ options.metrics_path };
 
     // instantiate state manager
     auto& manager = rostrum::manager::get_instance();
 
-    // initialize lua state
+    // initialize lua state. module libraries are released after it is closed
+    rostrum::module_refs modules;
     sol::state lua;
-    manager.init_state(lua);
+    manager.init_state(lua, modules);
+
+    // stopped before the state is closed
+    if (!options.memprofile_path.empty()) {
+      rostrum::memprofile::start(lua, { options.memprofile_interval });
+    }
+    [[maybe_unused]] const memprofile_guard memprofile_guard{ options.memprofile_path, lua };
 
     // load rostrum modules
+    if (options.watch_modules) {
+      manager.watch_modules();
+    }
     manager.reload_rostrum_modules();
 
     // load and run script
     using rostrum::sol_check;
-    auto script = sol_check(lua.load_file(script_name));
+    XXH128_hash_t script_hash;
+    auto script = sol_check(rostrum::load_script(lua, script_name, script_hash));
+    spdlog::debug("loaded script '{}' ({})", script_name, rostrum::to_hex(script_hash));
     sol_check(script(script_args));
     return EXIT_SUCCESS;
   }
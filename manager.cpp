@@ -2,6 +2,17 @@
 #include <vector>
 #include <utility>
 #include <iostream>
+#include <optional>
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <cstdlib>
+#include <random>
 
 #include <boost/dll.hpp>
 
@@ -9,6 +20,17 @@
 
 #include "manager.h"
 #include "core_module.h"
+#include "sol_check.h"
+#include "module_manifest.h"
+#include "module_watcher.h"
+#include "metrics.h"
+#include "lua_buffer.h"
+#include "completion_queue.h"
+#include "script_runner.h"
+#include "state_alloc.h"
+#include "budget.h"
+#include "gc_telemetry.h"
+#include "module_index.h"
 
 namespace rostrum {
   class manager::impl {
@@ -18,16 +40,222 @@ namespace rostrum {
 
     inline static const auto rostrum_folder = boost::dll::program_location().parent_path().parent_path().string();
     inline static const auto modules_dir = "\\modules";
+    inline static const auto manifest_file = "\\modules.manifest";
+
+    // registry keys of per state module bookkeeping
+    inline static const auto tables_key = "rostrum.modules";
+    inline static const auto libs_key = "rostrum.libs";
+    inline static const auto generations_key = "rostrum.generations";
+    inline static const auto reload_hooks_key = "rostrum.reload_hooks";
+
+    // library is opened on first require.
+    // module_refs of states that imbued the module hold a reference, so replaced library is unloaded after the last of them is closed
+    struct lib_info {
+      manifest::entry entry;
+      std::shared_ptr<boost::dll::shared_library> lib;
+      std::uint64_t generation;
+    };
+
+    struct string_hash {
+      using is_transparent = void;
+      std::size_t operator() (const std::string_view s) const noexcept {
+        return std::hash<std::string_view>{}(s);
+      }
+    };
 
-    using lib_info = std::pair<boost::dll::shared_library, api::module_info>;
     std::vector<lib_info> libs_;
+    // module name to index in libs_
+    std::unordered_map<std::string, std::size_t, string_hash, std::equal_to<>> index_;
+    std::mutex libs_mutex_;
+    std::atomic<std::uint64_t> generation_{ 0 };
+    std::unique_ptr<module_watcher> watcher_;
+
+    // modules are loaded from copies while watching, so the original file can be rebuilt and library with the same path loaded again
+    bool shadow_copy_ = false;
+    // private directory of this process for the copies. removed at shutdown
+    std::filesystem::path shadow_dir_;
+    std::uint64_t shadow_copies_ = 0;
+
+    static std::filesystem::path make_private_dir() {
+      namespace fs = std::filesystem;
+
+#ifdef _WIN32
+      // temp directory is per user on windows. name must not exist yet
+      std::random_device random;
+      for (auto attempt = 0; attempt < 16; ++attempt) {
+        auto dir = fs::temp_directory_path() / ("rostrum-modules-" + std::to_string(random()));
+        if (fs::create_directory(dir)) {
+          return dir;
+        }
+      }
+      throw std::runtime_error("cannot create directory for module copies");
+#else
+      // mkdtemp creates a new directory with mode 0700
+      auto pattern = (fs::temp_directory_path() / "rostrum-modules-XXXXXX").string();
+      if (::mkdtemp(std::data(pattern)) == nullptr) {
+        throw std::runtime_error("cannot create directory for module copies");
+      }
+      return pattern;
+#endif
+    }
+
+    std::string shadow_copy(const manifest::entry& entry) {
+      namespace fs = std::filesystem;
+
+      if (shadow_dir_.empty()) {
+        shadow_dir_ = make_private_dir();
+        spdlog::debug("module copies are kept in '{}'", shadow_dir_.string());
+      }
+
+      // every load gets a fresh copy. file of a loaded library is never overwritten
+      const fs::path path = entry.path;
+      const auto copy = shadow_dir_ / (path.stem().string() + '.' + std::to_string(++shadow_copies_) + path.extension().string());
+      fs::copy_file(path, copy);
+      return copy.string();
+    }
+
+    static std::string_view module_name(const api::module_info& info) {
+      const auto name = std::data(info.name);
+      return { name, static_cast<std::size_t>(std::find(name, name + std::size(info.name), '\0') - name) };
+    }
+
+    void load_library(lib_info& lib) {
+      using api::query_info_ptr;
+
+      auto library = std::make_shared<boost::dll::shared_library>(shadow_copy_ ? shadow_copy(lib.entry) : lib.entry.path);
+      spdlog::debug("loaded rostrum module '{}'", lib.entry.path);
+      const auto& query_info = library->get_alias<query_info_ptr>("__rostrum_query_info");
+      spdlog::debug("loading __rostrum_query_info...");
+
+      // 0.1 modules do not write fields added later
+      api::module_info info{};
+      query_info(info);
+      spdlog::debug("querying...");
+
+      const auto& version = info.apiVersion;
+      if (version.major != api::kRostrumApiVersion.major || version.minor > api::kRostrumApiVersion.minor) {
+        throw std::runtime_error("unsupported rostrum api version " + std::to_string(version.major) + '.' + std::to_string(version.minor));
+      }
+      lib.entry.info = info;
+      lib.lib = std::move(library);
+    }
+
+    // imbue module into the state. functions declared by 0.2 modules are registered in bulk
+    static sol::table build_table(sol::state_view& lua, const api::module_info& info, const std::string& name) {
+      sol::table t = info.imbue != nullptr ? info.imbue(lua) : lua.create_table(0, static_cast<int>(info.function_count));
+
+      const auto register_functions = [&](const bool instrumented) {
+        for (std::size_t i = 0; i < info.function_count; ++i) {
+          const auto& f = info.functions[i];
+          if (((f.flags & api::kFunctionNoInstrument) == 0) == instrumented) {
+            t.set(f.name, f.function);
+          }
+        }
+      };
+
+      register_functions(true);
+      t.push();
+      metrics::instrument(lua, -1, name);
+      lua_pop(lua, 1);
+      register_functions(false);
+      return t;
+    }
+
+    // built tables are cached per state while module generation is the same
+    static sol::optional<sol::table> cached_table(sol::state_view& lua, const std::string_view name, const std::uint64_t generation) {
+      auto registry = lua.registry();
+      const sol::optional<sol::table> tables = registry[tables_key];
+      if (!tables) {
+        return sol::nullopt;
+      }
+      const sol::optional<sol::table> entry = (*tables)[name];
+      if (!entry || entry->get<std::uint64_t>(1) != generation) {
+        return sol::nullopt;
+      }
+      return entry->get<sol::table>(2);
+    }
+
+    static void cache_table(sol::state_view& lua, const std::string_view name, const std::uint64_t generation, const sol::table& t) {
+      auto registry = lua.registry();
+      sol::table tables = registry[tables_key].get_or_create<sol::table>();
+      tables[name] = lua.create_table_with(1, generation, 2, t);
+    }
 
   public:
-    void init_state(sol::state_view& lua) {
+    ~impl() {
+      watcher_.reset();
+      libs_.clear();
+
+      if (!shadow_dir_.empty()) {
+        std::error_code ec;
+        std::filesystem::remove_all(shadow_dir_, ec);
+      }
+    }
+
+    // searcher of ':name' rostrum modules
+    static int rostrum_searcher(lua_State* L) {
+      const auto path = sol::stack::get<std::string_view>(L, 1);
+      if (std::size(path) > 0 && path[0] == ':') {
+        sol::stack::push(L, +[](lua_State* L) {
+          const std::string_view path = sol::stack::get<std::string_view>(L, 1).substr(1);
+          spdlog::debug("rostrum package loader: requested '{}'", path);
+
+          // load internal core or external rostrum module into lua state
+          sol::state_view lua(L);
+          auto& self = *get_instance().impl_;
+          if (path == "core") {
+            if (const auto cached = cached_table(lua, path, 0)) {
+              sol::stack::push(L, *cached);
+              return 1;
+            }
+            auto t = imbue_core(lua);
+            t.push();
+            metrics::instrument(L, -1, "core");
+            lua_pop(L, 1);
+            cache_table(lua, path, 0, t);
+            sol::stack::push(L, t);
+            return 1;
+          }
+
+          if (const auto cached = cached_table(lua, path, self.generation(path))) {
+            sol::stack::push(L, *cached);
+            return 1;
+          }
+
+          const auto lib = self.acquire(path);
+          auto t = build_table(lua, lib.entry.info, std::string(path));
+          track(lua, lib);
+          cache_table(lua, path, lib.generation, t);
+
+          sol::stack::push(L, t);
+          return 1;
+        });
+        return 1;
+      }
+      return 0;
+    }
+
+    void init_state(sol::state_view& lua, module_refs& modules) {
+      // owner outlives the state, so it is referenced by light userdata
+      lua_pushlightuserdata(lua, &modules);
+      lua_setfield(lua, LUA_REGISTRYINDEX, libs_key);
+
+      // allocations of libs are accounted too
+      alloc::install(lua);
+      budget::install(lua);
+
       // load only base and package libs by default
       lua.open_libraries(sol::lib::base, sol::lib::package);
       spdlog::debug("imbuing lua state with lib::base | lib::package");
 
+      // wraps collectgarbage of the base lib
+      gc::install(lua);
+
+      // buffers can be pushed by core and modules before any of them is required
+      lua_buffer::register_type(lua);
+      // host services for modules, e.g. completion queue
+      completion_queue::install(lua);
+
       // set CPATH to modules/?.lmod
       const auto cpath = rostrum_folder + modules_dir + +"\\?" + lua_module_ext;
       lua["package"]["cpath"] = cpath;
@@ -35,33 +263,22 @@ namespace rostrum {
 
       spdlog::debug("adding rostrum package loader", cpath);
       // specify package loader for rostrum modules
-      lua.add_package_loader(+[](lua_State* L) {
-        const auto path = sol::stack::get<std::string_view>(L, 1);
-        if (std::size(path) > 0 && path[0] == ':') {
-          sol::stack::push(L, +[](lua_State* L) {
-            const std::string_view path = sol::stack::get<std::string_view>(L, 1).substr(1);
-            spdlog::debug("rostrum package loader: requested '{}'", path);
-
-            // load internal core or external rostrum module into lua state
-            sol::state_view lua(L);
-            auto&& t = (path == "core") ? imbue_core(lua) : get_instance().get(path).imbue(lua);
-
-            sol::stack::push(L, t);
-            return 1;
-          });
-          return 1;
-        }
-        return 0;
-      });
+      lua.add_package_loader(rostrum_searcher);
+      // lua, c and all-in-one searchers are answered from listings of package paths
+      module_index::install(lua, rostrum_searcher);
     }
 
     void reload_rostrum_modules() {
       namespace fs = std::filesystem;
-      using api::module_info, api::query_info_ptr;
 
-      // TODO: figure out if sol3/lua terminates it state when unloading library
-      libs_.clear();
+      std::scoped_lock lock(libs_mutex_);
 
+      const auto manifest_path = rostrum_folder + manifest_file;
+      const auto cached = manifest::read(manifest_path);
+      auto dirty = false;
+
+      // replaced libraries stay loaded while any state references them (see lib_info)
+      std::vector<lib_info> libs;
       for (const auto& module : fs::directory_iterator(rostrum_folder + modules_dir)) {
         try {
           const auto& path = module.path();
@@ -71,37 +288,179 @@ namespace rostrum {
             continue;
           }
 
-          // load module and query info
-          auto& [name, info] = libs_.emplace_back(std::make_pair(path.string(), module_info{}));
-          spdlog::debug("loaded rostrum module '{}'", path.string());
-          const auto& query_info = name.get_alias<query_info_ptr>("__rostrum_query_info");
-          spdlog::debug("loading __rostrum_query_info...");
-          query_info(info);
-          spdlog::debug("querying...");
+          auto entry = manifest::stat(path);
+
+          // keep already opened library if it was not changed
+          const auto loaded = std::find_if(std::begin(libs_), std::end(libs_), [&](const auto& lib) { return lib.entry.matches(entry); });
+          if (loaded != std::end(libs_)) {
+            libs.push_back(std::move(*loaded));
+            continue;
+          }
+
+          // use cached query info. library is loaded lazily
+          const auto cached_entry = std::find_if(std::begin(cached), std::end(cached), [&](const auto& e) { return e.matches(entry); });
+          if (cached_entry != std::end(cached)) {
+            spdlog::debug("using cached info of rostrum module '{}'", path.string());
+            libs.push_back({ *cached_entry, nullptr, ++generation_ });
+            continue;
+          }
+
+          // new or changed module. it is loaded anyway so keep it
+          auto& lib = libs.emplace_back(lib_info{ std::move(entry), nullptr, ++generation_ });
+          try {
+            load_library(lib);
+          }
+          catch (...) {
+            libs.pop_back();
+            throw;
+          }
+          dirty = true;
         }
         catch (const std::exception& e) {
           spdlog::error("failed to load {}: {}", module.path().string(), e.what());
+
+          // keep previous version of the module if the new one is broken
+          const auto path = module.path().string();
+          const auto previous = std::find_if(std::begin(libs_), std::end(libs_), [&](const auto& lib) { return lib.lib && lib.entry.path == path; });
+          if (previous != std::end(libs_)) {
+            spdlog::warn("keeping previously loaded version of {}", path);
+            libs.push_back(std::move(*previous));
+          }
         }
         catch (...) {
           spdlog::error("system error while loading {}", module.path().string());
           throw;
         }
       }
+
+      libs_ = std::move(libs);
+      index_.clear();
+      for (std::size_t i = 0; i < std::size(libs_); ++i) {
+        index_.emplace(module_name(libs_[i].entry.info), i);
+      }
+      // modules directory is indexed for require too
+      module_index::invalidate();
+
+      // rewrite manifest if any module was added, changed or removed
+      if (dirty || std::size(cached) != std::size(libs_)) {
+        std::vector<manifest::entry> entries;
+        entries.reserve(std::size(libs_));
+        for (const auto& lib : libs_) {
+          entries.push_back(lib.entry);
+        }
+
+        try {
+          manifest::write(manifest_path, entries);
+          spdlog::debug("module manifest '{}' updated", manifest_path);
+        }
+        catch (const std::exception& e) {
+          spdlog::warn("failed to update module manifest: {}", e.what());
+        }
+      }
+    }
+
+    lib_info acquire(const std::string_view name) {
+      std::scoped_lock lock(libs_mutex_);
+
+      const auto it = index_.find(name);
+      if (it == std::end(index_)) {
+        throw std::runtime_error("module " + std::string(name) + " not found");
+      }
+
+      auto& lib = libs_[it->second];
+      if (!lib.lib) {
+        load_library(lib);
+      }
+      return lib;
     }
 
     api::module_info get(const std::string_view name) {
-      for (const auto& [_, info] : libs_) {
-        if (name == static_cast<const char*>(std::data(info.name))) {
-          return info;
+      return acquire(name).entry.info;
+    }
+
+    [[nodiscard]] std::uint64_t generation(const std::string_view name) {
+      std::scoped_lock lock(libs_mutex_);
+
+      const auto it = index_.find(name);
+      return it != std::end(index_) ? libs_[it->second].generation : 0;
+    }
+
+    // keep library referenced by the state and remember which generation of the module it imbued
+    static void track(sol::state_view& lua, const lib_info& lib) {
+      lua_getfield(lua, LUA_REGISTRYINDEX, libs_key);
+      auto* modules = static_cast<module_refs*>(lua_touserdata(lua, -1));
+      lua_pop(lua, 1);
+      if (modules == nullptr) {
+        throw std::runtime_error("state was not initialized by manager");
+      }
+      modules->hold(lib.lib);
+
+      auto registry = lua.registry();
+      sol::table generations = registry[generations_key].get_or_create<sol::table>();
+      generations[module_name(lib.entry.info)] = lib.generation;
+    }
+
+    void watch_modules() {
+      {
+        std::scoped_lock lock(libs_mutex_);
+        if (watcher_) {
+          return;
         }
+        shadow_copy_ = true;
       }
 
-      const std::string name_string = std::data(name);
-      throw std::runtime_error("module " + name_string + " not found");
+      const auto dir = rostrum_folder + modules_dir;
+      watcher_ = std::make_unique<module_watcher>(dir, [this] { reload_rostrum_modules(); });
+      spdlog::debug("watching module directory '{}'", dir);
+    }
+
+    static void on_module_reload(sol::state_view& lua, const sol::protected_function& hook) {
+      sol::table hooks = lua.registry()[reload_hooks_key].get_or_create<sol::table>();
+      hooks.add(hook);
+    }
+
+    // re-require modules of the state which were reloaded since imbued and pass new tables to hooks
+    std::size_t poll_reloads(sol::state_view& lua) {
+      auto registry = lua.registry();
+      const sol::optional<sol::table> generations = registry[generations_key];
+      if (!generations) {
+        return 0;
+      }
+
+      std::vector<std::string> changed;
+      for (const auto& [name, generation] : *generations) {
+        auto module = name.as<std::string>();
+        const auto current = this->generation(module);
+        if (current != 0 && current != generation.as<std::uint64_t>()) {
+          changed.push_back(std::move(module));
+        }
+      }
+
+      const sol::optional<sol::table> hooks = registry[reload_hooks_key];
+      for (const auto& name : changed) {
+        spdlog::info("reloading rostrum module '{}'", name);
+
+        const auto package = ':' + name;
+        lua["package"]["loaded"][package] = sol::lua_nil;
+        const sol::protected_function require = lua["require"];
+        const auto table = sol_check(require(package)).get<sol::object>();
+
+        if (hooks) {
+          for (const auto& [_, hook] : *hooks) {
+            sol_check(hook.as<sol::protected_function>()(name, table));
+          }
+        }
+      }
+      return std::size(changed);
     }
 
     static void imbue_lua_lib(sol::state_view& lua, const sol::lib lib) {
       lua.open_libraries(lib);
+      // output, os.exit and paths of scripts run by serve and batch
+      isolate_lib(lua, lib);
+      if (lib == sol::lib::jit) {
+        budget::restrict_jit(lua);
+      }
     }
   };
 
@@ -115,8 +474,8 @@ namespace rostrum {
     return instance;
   }
 
-  void manager::init_state(sol::state_view& lua) const {
-    impl_->init_state(lua);
+  void manager::init_state(sol::state_view& lua, module_refs& modules) const {
+    impl_->init_state(lua, modules);
   }
 
   void manager::reload_rostrum_modules() const {
@@ -127,6 +486,18 @@ namespace rostrum {
     return impl_->get(name);
   }
 
+  void manager::watch_modules() const {
+    impl_->watch_modules();
+  }
+
+  void manager::on_module_reload(sol::state_view& lua, const sol::protected_function& hook) const {
+    impl_->on_module_reload(lua, hook);
+  }
+
+  std::size_t manager::poll_reloads(sol::state_view& lua) const {
+    return impl_->poll_reloads(lua);
+  }
+
   void manager::imbue_lua_lib(sol::state_view&& lua, const sol::lib lib) const {
     impl_->imbue_lua_lib(lua, lib);
   }
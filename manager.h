@@ -1,9 +1,30 @@
 #pragma once
 #include <string_view>
 #include <memory>
+#include <vector>
+#include <utility>
 #include "include/api.hpp"
 
 namespace rostrum {
+  /*
+   * Libraries of rostrum modules imbued into a state.
+   * Finalizers of module objects run during lua_close, so libraries must stay
+   * mapped until the state is closed: declare the owner before the state.
+   */
+  class module_refs final {
+  public:
+    module_refs() = default;
+    module_refs(const module_refs&) = delete;
+    module_refs& operator= (const module_refs&) = delete;
+
+    void hold(std::shared_ptr<void> lib) {
+      libs_.push_back(std::move(lib));
+    }
+
+  private:
+    std::vector<std::shared_ptr<void>> libs_;
+  };
+
   class manager final {
   private:
     manager();
@@ -12,11 +33,17 @@ namespace rostrum {
   public:
     static manager& get_instance();
 
-    void init_state(sol::state_view& lua) const;
+    // @modules must outlive the state
+    void init_state(sol::state_view& lua, module_refs& modules) const;
 
     void reload_rostrum_modules() const;
     [[nodiscard]] api::module_info get(std::string_view name) const;
 
+    // reload changed modules in background. states pick them up with poll_reloads
+    void watch_modules() const;
+    void on_module_reload(sol::state_view& lua, const sol::protected_function& hook) const;
+    std::size_t poll_reloads(sol::state_view& lua) const;
+
     void imbue_lua_lib(sol::state_view&& lua, sol::lib lib) const;
 
   private:
@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <stdexcept>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace rostrum {
+
+  /*
+   * Read-only memory mapping of a whole file.
+   */
+  class mapped_file final {
+  public:
+    explicit mapped_file(const std::string& filename) {
+      namespace ipc = boost::interprocess;
+
+      std::error_code ec;
+      const auto size = std::filesystem::file_size(filename, ec);
+      if (ec) {
+        throw std::runtime_error(filename + " not found");
+      }
+
+      // empty files cannot be mapped
+      if (size == 0) {
+        return;
+      }
+
+      try {
+        mapping_ = ipc::file_mapping(filename.c_str(), ipc::read_only);
+        region_ = ipc::mapped_region(mapping_, ipc::read_only, 0, static_cast<std::size_t>(size));
+      }
+      catch (const ipc::interprocess_exception& e) {
+        throw std::runtime_error("cannot map " + filename + ": " + e.what());
+      }
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file(mapped_file&&) noexcept = default;
+    mapped_file& operator= (const mapped_file&) = delete;
+    mapped_file& operator= (mapped_file&&) noexcept = default;
+
+    [[nodiscard]] const char* data() const noexcept {
+      return static_cast<const char*>(region_.get_address());
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept {
+      return region_.get_size();
+    }
+
+    [[nodiscard]] std::string_view view() const noexcept {
+      return { data(), size() };
+    }
+
+  private:
+    boost::interprocess::file_mapping mapping_;
+    boost::interprocess::mapped_region region_;
+  };
+}
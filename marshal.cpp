@@ -0,0 +1,127 @@
+#include <string>
+#include <stdexcept>
+
+#include "marshal.h"
+
+namespace rostrum::marshal {
+  namespace {
+    // nested tables deeper than this are most likely cyclic
+    constexpr auto kMaxDepth = 64;
+
+    value from_index(lua_State* L, const int index, const int depth) {
+      switch (lua_type(L, index)) {
+      case LUA_TNIL:
+        return {};
+      case LUA_TBOOLEAN:
+        return { lua_toboolean(L, index) != 0 };
+      case LUA_TNUMBER:
+        return { lua_tonumber(L, index) };
+      case LUA_TSTRING: {
+        std::size_t len;
+        const auto str = lua_tolstring(L, index, &len);
+        return { std::string(str, len) };
+      }
+      case LUA_TTABLE: {
+        if (depth == kMaxDepth) {
+          throw std::runtime_error("cannot marshal table: nesting is too deep or cyclic");
+        }
+        luaL_checkstack(L, 2, "marshal");
+        const auto abs_index = index > 0 ? index : lua_gettop(L) + index + 1;
+
+        value::table t;
+        lua_pushnil(L);
+        while (lua_next(L, abs_index) != 0) {
+          auto k = from_index(L, -2, depth + 1);
+          auto v = from_index(L, -1, depth + 1);
+          t.emplace_back(std::move(k), std::move(v));
+          lua_pop(L, 1);
+        }
+        return { std::move(t) };
+      }
+      case LUA_TUSERDATA:
+        if (const auto b = api::to_buffer(L, index)) {
+          return { *b };
+        }
+        [[fallthrough]];
+      default:
+        throw std::runtime_error(std::string("cannot marshal value of type ") + luaL_typename(L, index));
+      }
+    }
+
+    void push_value(lua_State* L, const value& v) {
+      luaL_checkstack(L, 3, "marshal");
+      std::visit([L](const auto& data) {
+        using T = std::decay_t<decltype(data)>;
+        if constexpr (std::is_same_v<T, std::monostate>) {
+          lua_pushnil(L);
+        }
+        else if constexpr (std::is_same_v<T, bool>) {
+          lua_pushboolean(L, data);
+        }
+        else if constexpr (std::is_same_v<T, lua_Number>) {
+          lua_pushnumber(L, data);
+        }
+        else if constexpr (std::is_same_v<T, std::string>) {
+          lua_pushlstring(L, std::data(data), std::size(data));
+        }
+        else if constexpr (std::is_same_v<T, api::buffer>) {
+          api::push_buffer(L, data);
+        }
+        else {
+          lua_createtable(L, 0, static_cast<int>(std::size(data)));
+          for (const auto& [k, v] : data) {
+            push_value(L, k);
+            push_value(L, v);
+            lua_rawset(L, -3);
+          }
+        }
+      }, v.data);
+    }
+
+    int string_writer(lua_State*, const void* p, const std::size_t sz, void* ud) {
+      static_cast<std::string*>(ud)->append(static_cast<const char*>(p), sz);
+      return 0;
+    }
+  }
+
+  values from_stack(lua_State* L, const int first, const int count) {
+    values result;
+    result.reserve(count);
+    for (auto i = 0; i < count; ++i) {
+      result.push_back(from_index(L, first + i, 0));
+    }
+    return result;
+  }
+
+  void push(lua_State* L, const value& v) {
+    push_value(L, v);
+  }
+
+  int push(lua_State* L, const values& v) {
+    for (const auto& value : v) {
+      push_value(L, value);
+    }
+    return static_cast<int>(std::size(v));
+  }
+
+  std::string dump_function(lua_State* L, const int index) {
+    if (lua_type(L, index) != LUA_TFUNCTION || lua_iscfunction(L, index)) {
+      throw std::runtime_error("only lua functions can be dumped");
+    }
+
+    // upvalues are not part of bytecode and would silently become nil in the other state
+    if (const auto name = lua_getupvalue(L, index, 1)) {
+      lua_pop(L, 1);
+      throw std::runtime_error(std::string("function captures upvalue '") + name + "'. pass it as an argument instead");
+    }
+
+    std::string bytecode;
+    lua_pushvalue(L, index);
+    const auto status = lua_dump(L, string_writer, &bytecode);
+    lua_pop(L, 1);
+    if (status != 0) {
+      throw std::runtime_error("failed to dump function");
+    }
+    return bytecode;
+  }
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <variant>
+
+#include "include/api.hpp"
+#include "include/buffer.hpp"
+
+namespace rostrum::marshal {
+
+  /*
+   * State independent copy of a lua value.
+   * Used to pass arguments and results between different lua states.
+   * Buffers are shared, not copied.
+   */
+  struct value {
+    using table = std::vector<std::pair<value, value>>;
+    std::variant<std::monostate, bool, lua_Number, std::string, table, api::buffer> data;
+  };
+
+  using values = std::vector<value>;
+
+  // copy @count lua values starting at stack index @first
+  [[nodiscard]]
+  values from_stack(lua_State* L, int first, int count);
+
+  void push(lua_State* L, const value& v);
+
+  // push values onto the stack. returns the number of pushed values
+  int push(lua_State* L, const values& v);
+
+  // dump lua function at @index into bytecode, loadable by any other state
+  [[nodiscard]]
+  std::string dump_function(lua_State* L, int index);
+}
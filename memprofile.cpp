@@ -0,0 +1,279 @@
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "memprofile.h"
+
+namespace rostrum {
+  namespace {
+    // filter is rebuilt once this many more addresses were added than blocks are live
+    constexpr std::size_t kFilterSlack = 1024;
+
+    std::string frame_name(lua_State* L, lua_Debug& ar) {
+      lua_getinfo(L, "nSl", &ar);
+      if (ar.what[0] == 'C') {
+        return ar.name != nullptr ? std::string("[C] ") + ar.name : "[C]";
+      }
+
+      // line of the call or allocation. semicolons separate frames in collapsed output
+      auto name = std::string(ar.name != nullptr ? ar.name : ar.what[0] == 'm' ? "main" : "?") + " (" + ar.short_src + ':' + std::to_string(ar.currentline) + ')';
+      std::replace(std::begin(name), std::end(name), ';', ':');
+      return name;
+    }
+
+    void write_collapsed(const std::string& path, std::vector<std::pair<std::string, std::uint64_t>> stacks) {
+      std::ofstream out(path, std::ios::trunc);
+      if (!out) {
+        throw std::runtime_error("cannot open memory profile output '" + path + '\'');
+      }
+      // sorted output is stable between runs and diffable
+      std::sort(std::begin(stacks), std::end(stacks));
+      for (const auto& [stack, bytes] : stacks) {
+        if (bytes != 0) {
+          out << stack << ' ' << bytes << '\n';
+        }
+      }
+    }
+  }
+
+  memprofile::memprofile(lua_State* L, alloc::context& context, const options& opts)
+    : state_(L), thread_ref_(LUA_NOREF), context_(context), options_(opts) {
+    lua_pushthread(L);
+    thread_ref_ = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+
+  memprofile* memprofile::get(lua_State* L) noexcept {
+    const auto c = alloc::get(L);
+    return c != nullptr ? dynamic_cast<memprofile*>(c->sampler.get()) : nullptr;
+  }
+
+  bool memprofile::running(lua_State* L) noexcept {
+    return get(L) != nullptr;
+  }
+
+  void memprofile::start(lua_State* L, const options& opts) {
+    if (opts.interval == 0 || opts.depth <= 0) {
+      throw std::invalid_argument("memory profiler interval and depth must be positive");
+    }
+    const auto c = alloc::get(L);
+    if (c == nullptr) {
+      throw std::runtime_error("lua state has no accounting allocator");
+    }
+    if (c->sampler != nullptr) {
+      throw std::runtime_error("memory profiler is already running");
+    }
+
+    auto profiler = std::make_unique<memprofile>(L, *c, opts);
+    c->filter.clear();
+    c->sample_interval = opts.interval;
+    c->sample_countdown = opts.interval;
+    c->sampler = std::move(profiler);
+    spdlog::debug("memory profiler started with {} bytes interval", opts.interval);
+  }
+
+  memprofile::stats memprofile::stop(lua_State* L, const std::string& path, const std::size_t top_count) {
+    const auto self = get(L);
+    if (self == nullptr) {
+      throw std::runtime_error("memory profiler is not running");
+    }
+    // destroyed on return, the allocator stops sampling first
+    const auto owned = std::move(alloc::get(L)->sampler);
+    self->disarm(L);
+    luaL_unref(L, LUA_REGISTRYINDEX, self->thread_ref_);
+    return self->write(path, top_count);
+  }
+
+  memprofile::stats memprofile::write(const std::string& path, const std::size_t top_count) const {
+    std::vector<std::pair<std::string, std::uint64_t>> allocated;
+    std::vector<std::pair<std::string, std::uint64_t>> live;
+    std::unordered_map<std::string, site> sites;
+    for (const auto& s : stacks_) {
+      allocated.emplace_back(s.key, s.allocated);
+      live.emplace_back(s.key, s.live);
+      auto& leaf = sites.try_emplace(s.leaf, site{ s.leaf, 0, 0, 0 }).first->second;
+      leaf.allocated += s.allocated;
+      leaf.live += s.live;
+      leaf.samples += s.samples;
+    }
+    write_collapsed(path, std::move(allocated));
+    write_collapsed(path + ".live", std::move(live));
+
+    stats result{ samples_, std::size(stacks_), {} };
+    for (auto& [_, s] : sites) {
+      result.top.push_back(std::move(s));
+    }
+    std::sort(std::begin(result.top), std::end(result.top), [](const site& a, const site& b) { return a.allocated > b.allocated; });
+    if (std::size(result.top) > top_count) {
+      result.top.resize(top_count);
+    }
+
+    std::ofstream out(path + ".top", std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error("cannot open memory profile output '" + path + ".top'");
+    }
+    out << "allocated_bytes\tlive_bytes\tsamples\tsite\n";
+    for (const auto& s : result.top) {
+      out << s.allocated << '\t' << s.live << '\t' << s.samples << '\t' << s.name << '\n';
+    }
+
+    spdlog::debug("memory profiler stopped: {} samples of {} stacks written to '{}'", samples_, std::size(stacks_), path);
+    return result;
+  }
+
+  // inside the allocator: only remember the block and arm the hook
+  void memprofile::sampled(void* ptr, std::size_t, const std::size_t weight) {
+    ++filtered_;
+    pending_.push_back({ ptr, weight, false });
+    if (armed_) {
+      return;
+    }
+    // hooks are per global state in LuaJIT, so it fires in whichever coroutine runs next.
+    // chained is the saved hook restored by the previous sample
+    if (const auto current = lua_gethook(state_); current != &memprofile::chained) {
+      saved_hook_ = current;
+      saved_mask_ = lua_gethookmask(state_);
+      saved_count_ = lua_gethookcount(state_);
+      saved_fired_ = true;
+    }
+    lua_sethook(state_, &memprofile::hook, LUA_MASKCOUNT, 1);
+    armed_ = true;
+  }
+
+  void memprofile::freed(void* ptr) {
+    for (auto& p : pending_) {
+      if (p.ptr == ptr) {
+        p.freed = true;
+      }
+    }
+    const auto it = live_.find(ptr);
+    if (it != std::end(live_)) {
+      stacks_[it->second.stack].live -= it->second.weight;
+      live_.erase(it);
+    }
+  }
+
+  // reallocated block keeps its stack and weight
+  void memprofile::moved(void* from, void* to) {
+    ++filtered_;
+    for (auto& p : pending_) {
+      if (p.ptr == from && !p.freed) {
+        p.ptr = to;
+      }
+    }
+    if (const auto it = live_.find(from); it != std::end(live_)) {
+      auto node = live_.extract(it);
+      node.key() = to;
+      live_.insert(std::move(node));
+    }
+  }
+
+  // samples of a closed state are dropped with the profiler
+  void memprofile::detached() {
+    spdlog::warn("memory profiled state closed before memprofile_stop");
+    armed_ = false;
+    pending_.clear();
+  }
+
+  void memprofile::hook(lua_State* L, lua_Debug* ar) {
+    const auto self = get(L);
+    if (self == nullptr) {
+      return;
+    }
+
+    // a count hook restarted by every sample would never fire if samples are closer than its count,
+    // so it is called here if it did not run since the previous sample
+    const auto count_hook = (self->saved_mask_ & LUA_MASKCOUNT) != 0;
+    const auto starved = count_hook && !self->saved_fired_;
+    self->armed_ = false;
+    if (count_hook) {
+      lua_sethook(L, &memprofile::chained, self->saved_mask_, self->saved_count_);
+      self->saved_fired_ = false;
+    }
+    else {
+      lua_sethook(L, self->saved_hook_, self->saved_mask_, self->saved_count_);
+    }
+
+    self->attribute(L);
+    if (starved) {
+      self->saved_hook_(L, ar);
+    }
+  }
+
+  // saved hook, noting that its count ran out
+  void memprofile::chained(lua_State* L, lua_Debug* ar) {
+    const auto self = get(L);
+    if (self == nullptr) {
+      return;
+    }
+    if (ar->event == LUA_HOOKCOUNT) {
+      self->saved_fired_ = true;
+    }
+    self->saved_hook_(L, ar);
+  }
+
+  void memprofile::disarm(lua_State* L) {
+    if (const auto current = lua_gethook(L); current == &memprofile::hook || current == &memprofile::chained) {
+      lua_sethook(L, saved_hook_, saved_mask_, saved_count_);
+    }
+    armed_ = false;
+  }
+
+  void memprofile::rebuild_filter() {
+    context_.filter.clear();
+    for (const auto& [ptr, _] : live_) {
+      context_.filter.insert(ptr);
+    }
+    filtered_ = std::size(live_);
+  }
+
+  void memprofile::attribute(lua_State* L) {
+    // containers below use the c++ heap, not the profiled allocator
+    auto& frames = frames_;
+    frames.clear();
+    lua_Debug ar;
+    for (auto level = 0; level < options_.depth && lua_getstack(L, level, &ar) != 0; ++level) {
+      frames.push_back(frame_name(L, ar));
+    }
+
+    auto& key = key_;
+    key.clear();
+    for (auto it = std::rbegin(frames); it != std::rend(frames); ++it) {
+      if (!key.empty()) {
+        key += ';';
+      }
+      key += *it;
+    }
+    if (key.empty()) {
+      key = "[unknown]";
+    }
+
+    auto [it, inserted] = stack_ids_.try_emplace(key, std::size(stacks_));
+    if (inserted) {
+      stacks_.push_back({ key, frames.empty() ? key : frames.front(), 0, 0, 0 });
+    }
+    auto& s = stacks_[it->second];
+
+    for (const auto& p : pending_) {
+      s.allocated += p.weight;
+      ++s.samples;
+      ++samples_;
+      if (!p.freed) {
+        s.live += p.weight;
+        // sampled again when grown by realloc
+        const auto [block, added] = live_.try_emplace(p.ptr, live_block{ it->second, p.weight });
+        if (!added) {
+          stacks_[block->second.stack].live -= block->second.weight;
+          block->second = { it->second, p.weight };
+        }
+      }
+    }
+    pending_.clear();
+
+    // freed samples stay in the filter until it is rebuilt
+    if (filtered_ > 2 * std::size(live_) + kFilterSlack) {
+      rebuild_filter();
+    }
+  }
+}
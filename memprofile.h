@@ -0,0 +1,107 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "include/api.hpp"
+#include "state_alloc.h"
+
+namespace rostrum {
+  /*
+   * Allocation sampling profiler of a lua state, built on its accounting allocator.
+   * Every interval allocated bytes one allocation is sampled; its lua stack is taken by a one-shot count hook
+   * on the next safe point, since the allocator cannot walk the stack. Allocations in JIT compiled code
+   * are attributed when the trace exits. Each state has its own profiler, owned by its allocator context.
+   */
+  class memprofile final : public alloc::observer {
+  public:
+    struct options {
+      std::size_t interval = 512 * 1024;
+      int depth = 64;
+    };
+
+    struct site {
+      std::string name;
+      std::uint64_t allocated;
+      std::uint64_t live;
+      std::uint64_t samples;
+    };
+
+    struct stats {
+      std::uint64_t samples;
+      std::size_t stacks;
+      // by allocated bytes, aggregated by source line of the allocation
+      std::vector<site> top;
+    };
+
+    memprofile(lua_State* L, alloc::context& context, const options& opts);
+
+    static void start(lua_State* L, const options& opts);
+
+    // stop sampling and write collapsed stacks of allocated bytes to @path, live bytes to @path.live
+    // and table of @top_count sites to @path.top
+    static stats stop(lua_State* L, const std::string& path, std::size_t top_count);
+
+    [[nodiscard]] static bool running(lua_State* L) noexcept;
+
+    void sampled(void* ptr, std::size_t size, std::size_t weight) override;
+    void freed(void* ptr) override;
+    void moved(void* from, void* to) override;
+    void detached() override;
+
+  private:
+    struct pending {
+      void* ptr;
+      std::uint64_t weight;
+      bool freed;
+    };
+
+    struct live_block {
+      std::size_t stack;
+      std::uint64_t weight;
+    };
+
+    struct stack_info {
+      std::string key;
+      std::string leaf;
+      std::uint64_t allocated;
+      std::uint64_t live;
+      std::uint64_t samples;
+    };
+
+    static memprofile* get(lua_State* L) noexcept;
+    static void hook(lua_State* L, lua_Debug* ar);
+    static void chained(lua_State* L, lua_Debug* ar);
+    void attribute(lua_State* L);
+    void disarm(lua_State* L);
+    void rebuild_filter();
+    [[nodiscard]] stats write(const std::string& path, std::size_t top_count) const;
+
+    // hooks are set through the thread profiling was started in, referenced so it is not collected
+    lua_State* state_;
+    int thread_ref_;
+    alloc::context& context_;
+    options options_;
+    std::uint64_t samples_{ 0 };
+    // addresses added to the allocator filter since it was rebuilt
+    std::size_t filtered_{ 0 };
+
+    // allocations waiting for the hook and the hook they replaced
+    std::vector<pending> pending_;
+    bool armed_{ false };
+    lua_Hook saved_hook_{ nullptr };
+    int saved_mask_{ 0 };
+    int saved_count_{ 0 };
+    // restoring a count hook restarts its count. it is called by the sample hook unless it ran since
+    bool saved_fired_{ true };
+
+    std::unordered_map<std::string, std::size_t> stack_ids_;
+    std::vector<stack_info> stacks_;
+    std::unordered_map<void*, live_block> live_;
+
+    // reused by attribute to not allocate on every sample
+    std::vector<std::string> frames_;
+    std::string key_;
+  };
+}
@@ -0,0 +1,220 @@
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <spdlog/spdlog.h>
+
+#include "metrics.h"
+
+namespace rostrum::metrics {
+  namespace {
+    struct counters {
+      std::atomic<std::uint64_t> calls{ 0 };
+      std::atomic<std::uint64_t> total_ns{ 0 };
+      std::array<std::atomic<std::uint64_t>, kBuckets> histogram{};
+    };
+
+    // written only by its thread. grows under mutex so collect can read it concurrently
+    struct thread_counters {
+      std::mutex mutex;
+      std::deque<counters> bindings;
+      std::atomic<std::size_t> size{ 0 };
+    };
+
+    std::atomic<bool> enabled_{ false };
+
+    std::mutex registry_mutex;
+    std::vector<std::pair<std::string, std::string>> names;
+    std::unordered_map<std::string, std::uint32_t> ids;
+    // outlive their threads so counters of finished workers are not lost
+    std::vector<std::shared_ptr<thread_counters>> threads;
+
+    thread_counters& local() {
+      thread_local const auto counters = [] {
+        auto result = std::make_shared<thread_counters>();
+        std::scoped_lock lock(registry_mutex);
+        threads.push_back(result);
+        return result;
+      }();
+      return *counters;
+    }
+
+    std::uint32_t register_binding(const std::string& module, const std::string& name) {
+      std::scoped_lock lock(registry_mutex);
+      const auto [it, inserted] = ids.try_emplace(module + '.' + name, static_cast<std::uint32_t>(std::size(names)));
+      if (inserted) {
+        names.emplace_back(module, name);
+      }
+      return it->second;
+    }
+
+    std::size_t bucket(std::uint64_t ns) {
+      std::size_t result = 0;
+      while (ns > 1 && result < kBuckets - 1) {
+        ns >>= 1;
+        ++result;
+      }
+      return result;
+    }
+
+    counters& get(const std::uint32_t id) {
+      auto& thread = local();
+      if (id >= thread.size.load(std::memory_order_relaxed)) {
+        std::scoped_lock lock(thread.mutex);
+        thread.bindings.resize(id + 1);
+        thread.size.store(id + 1, std::memory_order_relaxed);
+      }
+      return thread.bindings[id];
+    }
+
+    // upvalues: original function, binding id.
+    // no pcall, so errors and tracebacks pass through unchanged. calls which raise an error are counted but not timed
+    int instrumented_call(lua_State* L) {
+      auto& c = get(static_cast<std::uint32_t>(lua_tointeger(L, lua_upvalueindex(2))));
+      c.calls.fetch_add(1, std::memory_order_relaxed);
+
+      const auto nargs = lua_gettop(L);
+      lua_pushvalue(L, lua_upvalueindex(1));
+      lua_insert(L, 1);
+
+      const auto begin = std::chrono::steady_clock::now();
+      lua_call(L, nargs, LUA_MULTRET);
+      const auto ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+
+      c.total_ns.fetch_add(ns, std::memory_order_relaxed);
+      c.histogram[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+      return lua_gettop(L);
+    }
+
+    void write_string(std::ostream& out, const std::string& value) {
+      out << '"';
+      for (const auto c : value) {
+        if (c == '"' || c == '\\') {
+          out << '\\' << c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+          out << ' ';
+        }
+        else {
+          out << c;
+        }
+      }
+      out << '"';
+    }
+  }
+
+  void enable() noexcept {
+    enabled_ = true;
+  }
+
+  bool enabled() noexcept {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  void instrument(lua_State* L, int index, const std::string& module) {
+    if (!enabled()) {
+      return;
+    }
+
+    luaL_checkstack(L, 4, "metrics");
+    if (index < 0) {
+      index = lua_gettop(L) + index + 1;
+    }
+
+    // collect first. assigning existing fields while traversing is allowed but keep it simple
+    std::vector<std::string> functions;
+    lua_pushnil(L);
+    while (lua_next(L, index) != 0) {
+      if (lua_type(L, -2) == LUA_TSTRING && lua_iscfunction(L, -1)) {
+        functions.emplace_back(lua_tostring(L, -2));
+      }
+      lua_pop(L, 1);
+    }
+
+    for (const auto& name : functions) {
+      lua_getfield(L, index, name.c_str());
+      lua_pushinteger(L, static_cast<lua_Integer>(register_binding(module, name)));
+      lua_pushcclosure(L, &instrumented_call, 2);
+      lua_setfield(L, index, name.c_str());
+    }
+    spdlog::debug("instrumented {} native functions of '{}'", std::size(functions), module);
+  }
+
+  std::vector<binding> collect() {
+    std::scoped_lock lock(registry_mutex);
+
+    std::vector<binding> result;
+    result.reserve(std::size(names));
+    for (const auto& [module, name] : names) {
+      result.push_back({ module, name, 0, 0, {} });
+    }
+
+    for (const auto& thread : threads) {
+      std::scoped_lock thread_lock(thread->mutex);
+      for (std::size_t id = 0; id < std::size(thread->bindings); ++id) {
+        const auto& c = thread->bindings[id];
+        auto& b = result[id];
+        b.calls += c.calls.load(std::memory_order_relaxed);
+        b.total_ns += c.total_ns.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < kBuckets; ++i) {
+          b.histogram[i] += c.histogram[i].load(std::memory_order_relaxed);
+        }
+      }
+    }
+    return result;
+  }
+
+  void write_json(const std::string& path) {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error("cannot open metrics output '" + path + '\'');
+    }
+
+    const auto bindings = collect();
+
+    std::unordered_map<std::string, std::pair<std::uint64_t, std::uint64_t>> modules;
+    for (const auto& b : bindings) {
+      auto& [calls, total_ns] = modules[b.module];
+      calls += b.calls;
+      total_ns += b.total_ns;
+    }
+
+    out << "{\n  \"modules\": {";
+    auto first = true;
+    for (const auto& [module, totals] : modules) {
+      out << (first ? "\n    " : ",\n    ");
+      write_string(out, module);
+      out << ": { \"calls\": " << totals.first << ", \"total_ns\": " << totals.second << " }";
+      first = false;
+    }
+    out << "\n  },\n  \"bindings\": [";
+
+    first = true;
+    for (const auto& b : bindings) {
+      out << (first ? "\n    " : ",\n    ") << "{ \"module\": ";
+      write_string(out, b.module);
+      out << ", \"name\": ";
+      write_string(out, b.name);
+      out << ", \"calls\": " << b.calls << ", \"total_ns\": " << b.total_ns << ", \"histogram_log2_ns\": [";
+
+      // trailing empty buckets are omitted
+      auto last = kBuckets;
+      while (last > 0 && b.histogram[last - 1] == 0) {
+        --last;
+      }
+      for (std::size_t i = 0; i < last; ++i) {
+        out << (i == 0 ? "" : ", ") << b.histogram[i];
+      }
+      out << "] }";
+      first = false;
+    }
+    out << "\n  ]\n}\n";
+
+    spdlog::debug("metrics of {} bindings written to '{}'", std::size(bindings), path);
+  }
+}
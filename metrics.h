@@ -0,0 +1,39 @@
+#pragma once
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "include/api.hpp"
+
+/*
+ * Opt-in call counters and latency histograms of native functions exposed to lua.
+ * Counters are kept per thread and summed when queried.
+ */
+namespace rostrum::metrics {
+
+  // bucket i counts calls which took less than 2^(i+1) ns
+  constexpr std::size_t kBuckets = 40;
+
+  struct binding {
+    std::string module;
+    std::string name;
+    std::uint64_t calls;
+    std::uint64_t total_ns;
+    std::array<std::uint64_t, kBuckets> histogram;
+  };
+
+  void enable() noexcept;
+
+  [[nodiscard]]
+  bool enabled() noexcept;
+
+  // replace native functions of table at @index with counting wrappers. no-op if metrics are disabled.
+  // wrapper is a native frame between lua caller and the function, and functions which yield must not be wrapped
+  void instrument(lua_State* L, int index, const std::string& module);
+
+  [[nodiscard]]
+  std::vector<binding> collect();
+
+  void write_json(const std::string& path);
+}
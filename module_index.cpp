@@ -0,0 +1,249 @@
+#include <mutex>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <string_view>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <spdlog/spdlog.h>
+
+#include "module_index.h"
+
+namespace rostrum::module_index {
+  namespace {
+    namespace fs = std::filesystem;
+
+    // larger directories are not cached, their files are checked one by one
+    constexpr std::size_t kMaxEntries = 20000;
+
+    // standard searchers of package.loaders replaced by the index: lua, c and all-in-one
+    constexpr int kPreloadSearcher = 1;
+    constexpr int kReplacedSearchers = 3;
+
+    struct listing {
+      // names of regular files
+      std::unordered_set<std::string> files;
+      bool complete = true;
+    };
+
+    std::shared_mutex mutex;
+    // by directory, listed on first lookup of a module in it
+    std::unordered_map<std::string, std::shared_ptr<const listing>> listings;
+
+    // file names are case insensitive on windows
+    std::string normalize(std::string name) {
+#ifdef _WIN32
+      std::transform(std::begin(name), std::end(name), std::begin(name), [](const unsigned char c) { return static_cast<char>(std::tolower(c)); });
+#endif
+      return name;
+    }
+
+    std::string generic(std::string path) {
+      std::replace(std::begin(path), std::end(path), '\\', '/');
+      return path;
+    }
+
+    std::shared_ptr<const listing> get_listing(const std::string& dir) {
+      {
+        std::shared_lock lock(mutex);
+        if (const auto it = listings.find(dir); it != std::end(listings)) {
+          return it->second;
+        }
+      }
+
+      const auto begin = std::chrono::steady_clock::now();
+      auto result = std::make_shared<listing>();
+      std::error_code ec;
+      for (auto it = fs::directory_iterator(dir.empty() ? "." : dir, fs::directory_options::skip_permission_denied, ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+        if (std::size(result->files) >= kMaxEntries) {
+          result->files.clear();
+          result->complete = false;
+          break;
+        }
+        if (it->is_regular_file(ec)) {
+          result->files.insert(normalize(it->path().filename().string()));
+        }
+      }
+      spdlog::debug("module index: {} files in '{}'{} in {} us", std::size(result->files), dir, result->complete ? "" : " (not cached)",
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count());
+
+      std::unique_lock lock(mutex);
+      return listings.try_emplace(dir, std::move(result)).first->second;
+    }
+
+    bool exists(const std::string& file) {
+      const auto path = generic(file);
+      const auto slash = path.rfind('/');
+      const auto listing = get_listing(normalize(slash == std::string::npos ? std::string() : path.substr(0, slash + 1)));
+      if (!listing->complete) {
+        std::error_code ec;
+        return fs::is_regular_file(file, ec);
+      }
+      return listing->files.count(normalize(slash == std::string::npos ? path : path.substr(slash + 1))) != 0;
+    }
+
+    // substitute @name in templates of @paths like the standard searchers.
+    // pushes file name if found, otherwise "no file" message. no lua errors are raised while strings are alive
+    bool find(lua_State* L, const char* paths, const char* name) {
+      auto module = std::string(name);
+      std::replace(std::begin(module), std::end(module), '.', LUA_DIRSEP[0]);
+
+      const auto path = std::string_view(paths);
+      std::string file;
+      std::string message;
+      std::size_t begin = 0;
+      while (begin <= std::size(path)) {
+        const auto end = (std::min)(path.find(LUA_PATHSEP[0], begin), std::size(path));
+        const auto tpl = path.substr(begin, end - begin);
+        begin = end + 1;
+        if (tpl.empty()) {
+          continue;
+        }
+
+        file.clear();
+        for (const auto c : tpl) {
+          if (c == LUA_PATH_MARK[0]) {
+            file += module;
+          }
+          else {
+            file += c;
+          }
+        }
+        if (exists(file)) {
+          lua_pushlstring(L, std::data(file), std::size(file));
+          return true;
+        }
+        message += "\n\tno file '" + file + "'";
+      }
+      lua_pushlstring(L, std::data(message), std::size(message));
+      return false;
+    }
+
+    // "luaopen_" and name without "prefix-", dots replaced by underscores
+    void push_open_function_name(lua_State* L, const char* name) {
+      if (const auto mark = std::strchr(name, LUA_IGMARK[0])) {
+        name = mark + 1;
+      }
+      lua_pushliteral(L, "luaopen_");
+      luaL_gsub(L, name, ".", "_");
+      lua_concat(L, 2);
+    }
+
+    // package.loadlib of file at @filename. pushes loader or nil, message and "open" or "init"
+    void load_lib(lua_State* L, const int package, const int filename, const char* name) {
+      lua_getfield(L, package, "loadlib");
+      lua_pushvalue(L, filename);
+      push_open_function_name(L, name);
+      lua_call(L, 2, 3);
+    }
+
+    int searcher(lua_State* L) {
+      const auto name = luaL_checkstring(L, 1);
+      if (name[0] == ':') {
+        lua_pushvalue(L, lua_upvalueindex(1));
+        lua_pushvalue(L, 1);
+        lua_call(L, 1, 1);
+        return 1;
+      }
+
+      lua_getglobal(L, "package");
+      if (!lua_istable(L, -1)) {
+        lua_pushliteral(L, "\n\tno package table for module index");
+        return 1;
+      }
+      const auto package = lua_gettop(L);
+
+      lua_getfield(L, package, "path");
+      lua_getfield(L, package, "cpath");
+      const auto path = lua_tostring(L, -2);
+      const auto cpath = lua_tostring(L, -1);
+      if (path == nullptr) {
+        return luaL_error(L, "'package.path' must be a string");
+      }
+      if (cpath == nullptr) {
+        return luaL_error(L, "'package.cpath' must be a string");
+      }
+      const auto messages = lua_gettop(L) + 1;
+
+      if (find(L, path, name)) {
+        if (luaL_loadfile(L, lua_tostring(L, -1)) != 0) {
+          return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", name, lua_tostring(L, -2), lua_tostring(L, -1));
+        }
+        return 1;
+      }
+
+      if (find(L, cpath, name)) {
+        const auto filename = lua_gettop(L);
+        load_lib(L, package, filename, name);
+        if (lua_isnil(L, -3)) {
+          return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", name, lua_tostring(L, filename), lua_tostring(L, -2));
+        }
+        lua_pop(L, 2);
+        return 1;
+      }
+
+      // all-in-one library of the root name, e.g. a.so for a.b.c
+      if (const auto dot = std::strchr(name, '.')) {
+        lua_pushlstring(L, name, dot - name);
+        const auto root = lua_gettop(L);
+        if (find(L, cpath, lua_tostring(L, root))) {
+          const auto filename = lua_gettop(L);
+          load_lib(L, package, filename, name);
+          if (!lua_isnil(L, -3)) {
+            lua_pop(L, 2);
+            return 1;
+          }
+          // library without the open function is a miss, failing to load it is not
+          if (const auto where = lua_tostring(L, -1); where == nullptr || std::strcmp(where, "init") != 0) {
+            return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", name, lua_tostring(L, filename), lua_tostring(L, -2));
+          }
+          lua_pushfstring(L, "\n\tno module '%s' in file '%s'", name, lua_tostring(L, filename));
+          lua_replace(L, root);
+          lua_settop(L, root);
+        }
+        else {
+          lua_remove(L, root);
+        }
+      }
+
+      // not found message, require tries the remaining searchers
+      lua_concat(L, lua_gettop(L) - messages + 1);
+      return 1;
+    }
+  }
+
+  void install(lua_State* L, const lua_CFunction rostrum_searcher) {
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "loaders");
+    if (!lua_istable(L, -1) || lua_objlen(L, -1) < kPreloadSearcher + kReplacedSearchers) {
+      lua_pop(L, 2);
+      return;
+    }
+
+    // index takes the slot of the lua searcher, the c and all-in-one searchers are removed
+    const auto loaders = lua_gettop(L);
+    const auto count = static_cast<int>(lua_objlen(L, loaders));
+    for (auto i = kPreloadSearcher + kReplacedSearchers + 1; i <= count; ++i) {
+      lua_rawgeti(L, loaders, i);
+      lua_rawseti(L, loaders, i - kReplacedSearchers + 1);
+    }
+    for (auto i = count - kReplacedSearchers + 2; i <= count; ++i) {
+      lua_pushnil(L);
+      lua_rawseti(L, loaders, i);
+    }
+    lua_pushcfunction(L, rostrum_searcher);
+    lua_pushcclosure(L, searcher, 1);
+    lua_rawseti(L, loaders, kPreloadSearcher + 1);
+    lua_pop(L, 2);
+  }
+
+  void invalidate() {
+    std::unique_lock lock(mutex);
+    listings.clear();
+  }
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "include/api.hpp"
+
+/*
+ * Directory listings of package.path and package.cpath, read on first lookup of a module
+ * in a directory and shared by all states. Replaces the standard lua, c and all-in-one searchers,
+ * so require does not probe the filesystem file by file. Files of directories too large
+ * to cache are checked one by one.
+ */
+namespace rostrum::module_index {
+
+  // @rostrum_searcher handles names starting with ':'
+  void install(lua_State* L, lua_CFunction rostrum_searcher);
+
+  // drop all listings. they are read again on next require, e.g. after modules were reloaded
+  void invalidate();
+}
@@ -0,0 +1,99 @@
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "module_manifest.h"
+
+namespace rostrum::manifest {
+  namespace {
+    constexpr char kMagic[8] = { 'R', 'M', 'O', 'D', 'M', 'A', 'N', '1' };
+
+    template <typename T>
+    void write_pod(std::ostream& out, const T& value) {
+      out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    T read_pod(std::istream& in) {
+      T value;
+      if (!in.read(reinterpret_cast<char*>(&value), sizeof(T))) {
+        throw std::runtime_error("unexpected end of file");
+      }
+      return value;
+    }
+  }
+
+  entry stat(const std::filesystem::path& path) {
+    const auto mtime = std::filesystem::last_write_time(path).time_since_epoch().count();
+    return { path.string(), static_cast<std::int64_t>(mtime), std::filesystem::file_size(path), {} };
+  }
+
+  std::vector<entry> read(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      return {};
+    }
+
+    try {
+      const auto magic = read_pod<std::array<char, sizeof(kMagic)>>(in);
+      const auto version = read_pod<api::api_version>(in);
+      if (std::memcmp(std::data(magic), kMagic, sizeof(kMagic)) != 0 ||
+          version.major != api::kRostrumApiVersion.major || version.minor != api::kRostrumApiVersion.minor) {
+        spdlog::debug("module manifest '{}' is outdated", path);
+        return {};
+      }
+
+      const auto count = read_pod<std::uint32_t>(in);
+      std::vector<entry> entries;
+      entries.reserve(count);
+      for (std::uint32_t i = 0; i < count; ++i) {
+        auto& e = entries.emplace_back();
+        e.path.resize(read_pod<std::uint32_t>(in));
+        if (!in.read(std::data(e.path), std::size(e.path))) {
+          throw std::runtime_error("unexpected end of file");
+        }
+        e.mtime = read_pod<std::int64_t>(in);
+        e.size = read_pod<std::uint64_t>(in);
+        e.info.apiVersion = read_pod<api::api_version>(in);
+        e.info.name = read_pod<api::module_name>(in);
+        e.info.description = read_pod<api::module_description>(in);
+        e.info.version = read_pod<api::module_version>(in);
+        e.info.imbue = nullptr;
+      }
+      return entries;
+    }
+    catch (const std::exception& e) {
+      spdlog::warn("ignoring corrupted module manifest '{}': {}", path, e.what());
+      return {};
+    }
+  }
+
+  void write(const std::string& path, const std::vector<entry>& entries) {
+    // write to temp file first so concurrent hosts never read partial manifest
+    const auto temp_path = path + ".tmp";
+    {
+      std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+      if (!out) {
+        throw std::runtime_error("cannot open module manifest '" + temp_path + "' for writing");
+      }
+
+      write_pod(out, kMagic);
+      write_pod(out, api::kRostrumApiVersion);
+      write_pod(out, static_cast<std::uint32_t>(std::size(entries)));
+      for (const auto& e : entries) {
+        write_pod(out, static_cast<std::uint32_t>(std::size(e.path)));
+        out.write(std::data(e.path), std::size(e.path));
+        write_pod(out, e.mtime);
+        write_pod(out, static_cast<std::uint64_t>(e.size));
+        write_pod(out, e.info.apiVersion);
+        write_pod(out, e.info.name);
+        write_pod(out, e.info.description);
+        write_pod(out, e.info.version);
+      }
+    }
+
+    std::filesystem::rename(temp_path, path);
+  }
+}
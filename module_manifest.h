@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+
+#include "include/api.hpp"
+
+namespace rostrum::manifest {
+
+  /*
+   * Cached query info of a rostrum module.
+   * Valid as long as module file has the same modification time and size.
+   */
+  struct entry {
+    std::string path;
+    std::int64_t mtime;
+    std::uintmax_t size;
+    api::module_info info;
+
+    [[nodiscard]] bool matches(const entry& other) const noexcept {
+      return path == other.path && mtime == other.mtime && size == other.size;
+    }
+  };
+
+  // stat module file. info is left empty
+  [[nodiscard]]
+  entry stat(const std::filesystem::path& path);
+
+  // returns no entries if manifest is missing, corrupted or written for other api version
+  [[nodiscard]]
+  std::vector<entry> read(const std::string& path);
+
+  void write(const std::string& path, const std::vector<entry>& entries);
+}
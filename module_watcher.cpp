@@ -0,0 +1,128 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <utility>
+#include <stdexcept>
+#include <filesystem>
+
+#include <spdlog/spdlog.h>
+
+#ifdef _WIN32
+# include <Windows.h>
+#elif defined(__linux__)
+# include <poll.h>
+# include <unistd.h>
+# include <sys/inotify.h>
+#endif
+
+#include "module_watcher.h"
+
+namespace rostrum {
+  class module_watcher::impl {
+  private:
+    // builds write modules in several steps. wait until they are done
+    inline static const auto quiet_period = std::chrono::milliseconds(300);
+    inline static const auto poll_interval = std::chrono::milliseconds(100);
+
+    std::string directory_;
+    std::function<void()> on_change_;
+    std::atomic<bool> stop_{ false };
+#ifdef _WIN32
+    HANDLE handle_{ INVALID_HANDLE_VALUE };
+#elif defined(__linux__)
+    int fd_{ -1 };
+#else
+    std::filesystem::file_time_type last_write_{};
+#endif
+    std::thread thread_;
+
+    // returns true if directory was changed during the timeout
+    bool wait_change(const std::chrono::milliseconds timeout) {
+#ifdef _WIN32
+      if (WaitForSingleObject(handle_, static_cast<DWORD>(timeout.count())) != WAIT_OBJECT_0) {
+        return false;
+      }
+      FindNextChangeNotification(handle_);
+      return true;
+#elif defined(__linux__)
+      pollfd pfd{ fd_, POLLIN, 0 };
+      if (poll(&pfd, 1, static_cast<int>(timeout.count())) <= 0) {
+        return false;
+      }
+      // drain events. which file changed is checked by manager
+      alignas(inotify_event) char buffer[4096];
+      while (read(fd_, buffer, sizeof(buffer)) > 0) {
+      }
+      return true;
+#else
+      std::this_thread::sleep_for(timeout);
+      auto latest = std::filesystem::file_time_type{};
+      std::error_code ec;
+      for (const auto& file : std::filesystem::directory_iterator(directory_, ec)) {
+        latest = (std::max)(latest, file.last_write_time(ec));
+      }
+      return std::exchange(last_write_, latest) != latest;
+#endif
+    }
+
+    void run() {
+      while (!stop_) {
+        if (!wait_change(poll_interval)) {
+          continue;
+        }
+        while (!stop_ && wait_change(quiet_period)) {
+        }
+        if (stop_) {
+          break;
+        }
+
+        spdlog::debug("module directory '{}' changed", directory_);
+        try {
+          on_change_();
+        }
+        catch (const std::exception& e) {
+          spdlog::error("failed to handle change of module directory: {}", e.what());
+        }
+      }
+    }
+
+  public:
+    impl(std::string directory, std::function<void()> on_change) : directory_(std::move(directory)), on_change_(std::move(on_change)) {
+#ifdef _WIN32
+      handle_ = FindFirstChangeNotificationA(directory_.c_str(), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE);
+      if (handle_ == INVALID_HANDLE_VALUE) {
+#elif defined(__linux__)
+      fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      if (fd_ < 0 || inotify_add_watch(fd_, directory_.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE) < 0) {
+#else
+      wait_change(std::chrono::milliseconds(0));
+      if (!std::filesystem::is_directory(directory_)) {
+#endif
+        throw std::runtime_error("cannot watch module directory '" + directory_ + '\'');
+      }
+      thread_ = std::thread(&impl::run, this);
+    }
+
+    ~impl() {
+      stop_ = true;
+      if (thread_.joinable()) {
+        thread_.join();
+      }
+#ifdef _WIN32
+      if (handle_ != INVALID_HANDLE_VALUE) {
+        FindCloseChangeNotification(handle_);
+      }
+#elif defined(__linux__)
+      if (fd_ >= 0) {
+        close(fd_);
+      }
+#endif
+    }
+  };
+
+  module_watcher::module_watcher(std::string directory, std::function<void()> on_change) :
+    impl_(std::make_unique<impl>(std::move(directory), std::move(on_change))) {
+  }
+
+  module_watcher::~module_watcher() = default;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <functional>
+
+namespace rostrum {
+  /*
+   * Watches a directory and invokes callback on its own thread once files stop changing.
+   * Uses inotify on linux, change notifications on windows and polling elsewhere.
+   */
+  class module_watcher final {
+  public:
+    module_watcher(std::string directory, std::function<void()> on_change);
+    ~module_watcher();
+
+    module_watcher(const module_watcher&) = delete;
+    module_watcher& operator= (const module_watcher&) = delete;
+
+  private:
+    class impl;
+    std::unique_ptr<impl> impl_;
+  };
+}
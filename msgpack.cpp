@@ -0,0 +1,408 @@
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "msgpack.h"
+
+namespace rostrum::msgpack {
+  namespace {
+    // nested tables deeper than this are most likely cyclic
+    constexpr auto kMaxDepth = 512;
+    constexpr std::size_t kChunkSize = 1024 * 1024;
+
+    template <typename T>
+    void put_be(std::string& out, const T value) {
+      char bytes[sizeof(T)];
+      for (std::size_t i = 0; i < sizeof(T); ++i) {
+        bytes[i] = static_cast<char>(static_cast<std::uint64_t>(value) >> (8 * (sizeof(T) - 1 - i)));
+      }
+      out.append(bytes, sizeof(T));
+    }
+
+    template <typename T>
+    T get_be(const unsigned char* p) {
+      std::uint64_t value = 0;
+      for (std::size_t i = 0; i < sizeof(T); ++i) {
+        value = (value << 8) | p[i];
+      }
+      return static_cast<T>(value);
+    }
+
+    /*
+     * Appends to output string. Flushes it to file once it grows over chunk size, if streaming.
+     */
+    class writer final {
+    public:
+      writer(lua_State* L, std::string& out, std::FILE* file, const pack_options& opts) : L_(L), out_(out), file_(file), opts_(opts) {
+      }
+
+      void value(const int index, const int depth) {
+        switch (lua_type(L_, index)) {
+        case LUA_TNIL:
+          out_.push_back(static_cast<char>(0xc0));
+          break;
+        case LUA_TBOOLEAN:
+          out_.push_back(static_cast<char>(lua_toboolean(L_, index) ? 0xc3 : 0xc2));
+          break;
+        case LUA_TNUMBER:
+          number(lua_tonumber(L_, index));
+          break;
+        case LUA_TSTRING: {
+          std::size_t len;
+          const auto str = lua_tolstring(L_, index, &len);
+          header(len, 0xa0, 0xd9, 0xda, 0xdb, 32);
+          bytes(str, len);
+          break;
+        }
+        case LUA_TTABLE:
+          table(index, depth);
+          break;
+        case LUA_TUSERDATA:
+          if (const auto b = api::to_buffer(L_, index)) {
+            header(b->size(), 0, 0xc4, 0xc5, 0xc6, 0);
+            bytes(reinterpret_cast<const char*>(b->data()), b->size());
+            break;
+          }
+          [[fallthrough]];
+        default:
+          throw std::runtime_error(std::string("cannot pack value of type ") + luaL_typename(L_, index));
+        }
+        flush(false);
+      }
+
+      void flush(const bool force) {
+        if (file_ != nullptr && (force || std::size(out_) >= kChunkSize)) {
+          if (std::fwrite(std::data(out_), 1, std::size(out_), file_) != std::size(out_)) {
+            throw std::runtime_error("cannot write packed data");
+          }
+          written_ += std::size(out_);
+          out_.clear();
+        }
+      }
+
+      [[nodiscard]] std::size_t written() const noexcept {
+        return written_;
+      }
+
+    private:
+      void number(const lua_Number n) {
+        // integral values in int64 range
+        if (std::trunc(n) == n && n >= -9223372036854775808.0 && n < 9223372036854775808.0) {
+          const auto i = static_cast<std::int64_t>(n);
+          if (i >= 0) {
+            if (i < 0x80) {
+              out_.push_back(static_cast<char>(i));
+            }
+            else if (i <= 0xff) {
+              out_.push_back(static_cast<char>(0xcc));
+              put_be(out_, static_cast<std::uint8_t>(i));
+            }
+            else if (i <= 0xffff) {
+              out_.push_back(static_cast<char>(0xcd));
+              put_be(out_, static_cast<std::uint16_t>(i));
+            }
+            else if (i <= 0xffffffff) {
+              out_.push_back(static_cast<char>(0xce));
+              put_be(out_, static_cast<std::uint32_t>(i));
+            }
+            else {
+              out_.push_back(static_cast<char>(0xcf));
+              put_be(out_, static_cast<std::uint64_t>(i));
+            }
+          }
+          else if (i >= -32) {
+            out_.push_back(static_cast<char>(i));
+          }
+          else if (i >= INT8_MIN) {
+            out_.push_back(static_cast<char>(0xd0));
+            put_be(out_, static_cast<std::uint8_t>(i));
+          }
+          else if (i >= INT16_MIN) {
+            out_.push_back(static_cast<char>(0xd1));
+            put_be(out_, static_cast<std::uint16_t>(i));
+          }
+          else if (i >= INT32_MIN) {
+            out_.push_back(static_cast<char>(0xd2));
+            put_be(out_, static_cast<std::uint32_t>(i));
+          }
+          else {
+            out_.push_back(static_cast<char>(0xd3));
+            put_be(out_, static_cast<std::uint64_t>(i));
+          }
+          return;
+        }
+
+        std::uint64_t bits;
+        static_assert(sizeof(bits) == sizeof(n));
+        std::memcpy(&bits, &n, sizeof(bits));
+        out_.push_back(static_cast<char>(0xcb));
+        put_be(out_, bits);
+      }
+
+      // @fix is 0 if type has no fix format
+      void header(const std::size_t size, const unsigned fix, const unsigned c8, const unsigned c16, const unsigned c32, const std::size_t fix_limit) {
+        if (size < fix_limit) {
+          out_.push_back(static_cast<char>(fix | size));
+        }
+        else if (c8 != 0 && size <= 0xff) {
+          out_.push_back(static_cast<char>(c8));
+          put_be(out_, static_cast<std::uint8_t>(size));
+        }
+        else if (size <= 0xffff) {
+          out_.push_back(static_cast<char>(c16));
+          put_be(out_, static_cast<std::uint16_t>(size));
+        }
+        else if (size <= 0xffffffff) {
+          out_.push_back(static_cast<char>(c32));
+          put_be(out_, static_cast<std::uint32_t>(size));
+        }
+        else {
+          throw std::runtime_error("value is too large to pack");
+        }
+      }
+
+      void bytes(const char* data, std::size_t size) {
+        // large strings go to file without extra copy
+        if (file_ != nullptr && size >= kChunkSize) {
+          flush(true);
+          if (std::fwrite(data, 1, size, file_) != size) {
+            throw std::runtime_error("cannot write packed data");
+          }
+          written_ += size;
+          return;
+        }
+        out_.append(data, size);
+      }
+
+      void table(int index, const int depth) {
+        if (depth == kMaxDepth) {
+          throw std::runtime_error("cannot pack table: nesting is too deep or cyclic");
+        }
+        if (index < 0) {
+          index = lua_gettop(L_) + index + 1;
+        }
+
+        const auto pointer = lua_topointer(L_, index);
+        if (opts_.detect_cycles && !path_.insert(pointer).second) {
+          throw std::runtime_error("cannot pack table: cycle detected");
+        }
+        luaL_checkstack(L_, 3, "pack");
+
+        // array if keys are exactly 1..count. lua_objlen may report a border of a table with holes or other keys
+        std::size_t count = 0;
+        lua_Number max_key = 0;
+        auto sequence = true;
+        lua_pushnil(L_);
+        while (lua_next(L_, index) != 0) {
+          ++count;
+          if (sequence) {
+            const auto key = lua_type(L_, -2) == LUA_TNUMBER ? lua_tonumber(L_, -2) : 0;
+            if (key >= 1 && key == std::floor(key)) {
+              max_key = (std::max)(max_key, key);
+            }
+            else {
+              sequence = false;
+            }
+          }
+          lua_pop(L_, 1);
+        }
+
+        // distinct integer keys >= 1 with the largest equal to their count cover 1..count
+        if (count != 0 && sequence && max_key == static_cast<lua_Number>(count)) {
+          header(count, 0x90, 0, 0xdc, 0xdd, 16);
+          for (std::size_t i = 1; i <= count; ++i) {
+            lua_rawgeti(L_, index, static_cast<int>(i));
+            value(-1, depth + 1);
+            lua_pop(L_, 1);
+          }
+        }
+        else {
+          header(count, 0x80, 0, 0xde, 0xdf, 16);
+          lua_pushnil(L_);
+          while (lua_next(L_, index) != 0) {
+            value(-2, depth + 1);
+            value(-1, depth + 1);
+            lua_pop(L_, 1);
+          }
+        }
+
+        if (opts_.detect_cycles) {
+          path_.erase(pointer);
+        }
+      }
+
+      lua_State* L_;
+      std::string& out_;
+      std::FILE* file_;
+      const pack_options& opts_;
+      std::size_t written_{ 0 };
+      // tables on the current path
+      std::unordered_set<const void*> path_;
+    };
+
+    class reader final {
+    public:
+      reader(lua_State* L, const std::string_view bytes, const std::size_t offset, const api::buffer* source) :
+        L_(L), data_(reinterpret_cast<const unsigned char*>(std::data(bytes))), size_(std::size(bytes)), pos_(offset), source_(source) {
+      }
+
+      void value(const int depth) {
+        if (depth == kMaxDepth) {
+          throw std::runtime_error("cannot unpack: nesting is too deep");
+        }
+        luaL_checkstack(L_, 3, "unpack");
+
+        const auto tag = take(1)[0];
+        if (tag <= 0x7f) {
+          lua_pushnumber(L_, tag);
+        }
+        else if (tag <= 0x8f) {
+          map(tag & 0x0f, depth);
+        }
+        else if (tag <= 0x9f) {
+          array(tag & 0x0f, depth);
+        }
+        else if (tag <= 0xbf) {
+          string(tag & 0x1f);
+        }
+        else if (tag >= 0xe0) {
+          lua_pushnumber(L_, static_cast<std::int8_t>(tag));
+        }
+        else {
+          switch (tag) {
+          case 0xc0: lua_pushnil(L_); break;
+          case 0xc2: lua_pushboolean(L_, 0); break;
+          case 0xc3: lua_pushboolean(L_, 1); break;
+          case 0xc4: bin(get_be<std::uint8_t>(take(1))); break;
+          case 0xc5: bin(get_be<std::uint16_t>(take(2))); break;
+          case 0xc6: bin(get_be<std::uint32_t>(take(4))); break;
+          case 0xca: {
+            const auto bits = get_be<std::uint32_t>(take(4));
+            float f;
+            std::memcpy(&f, &bits, sizeof(f));
+            lua_pushnumber(L_, f);
+            break;
+          }
+          case 0xcb: {
+            const auto bits = get_be<std::uint64_t>(take(8));
+            double d;
+            std::memcpy(&d, &bits, sizeof(d));
+            lua_pushnumber(L_, d);
+            break;
+          }
+          case 0xcc: lua_pushnumber(L_, get_be<std::uint8_t>(take(1))); break;
+          case 0xcd: lua_pushnumber(L_, get_be<std::uint16_t>(take(2))); break;
+          case 0xce: lua_pushnumber(L_, get_be<std::uint32_t>(take(4))); break;
+          case 0xcf: lua_pushnumber(L_, static_cast<lua_Number>(get_be<std::uint64_t>(take(8)))); break;
+          case 0xd0: lua_pushnumber(L_, static_cast<std::int8_t>(get_be<std::uint8_t>(take(1)))); break;
+          case 0xd1: lua_pushnumber(L_, static_cast<std::int16_t>(get_be<std::uint16_t>(take(2)))); break;
+          case 0xd2: lua_pushnumber(L_, static_cast<std::int32_t>(get_be<std::uint32_t>(take(4)))); break;
+          case 0xd3: lua_pushnumber(L_, static_cast<lua_Number>(static_cast<std::int64_t>(get_be<std::uint64_t>(take(8))))); break;
+          case 0xd9: string(get_be<std::uint8_t>(take(1))); break;
+          case 0xda: string(get_be<std::uint16_t>(take(2))); break;
+          case 0xdb: string(get_be<std::uint32_t>(take(4))); break;
+          case 0xdc: array(get_be<std::uint16_t>(take(2)), depth); break;
+          case 0xdd: array(get_be<std::uint32_t>(take(4)), depth); break;
+          case 0xde: map(get_be<std::uint16_t>(take(2)), depth); break;
+          case 0xdf: map(get_be<std::uint32_t>(take(4)), depth); break;
+          default:
+            throw std::runtime_error("cannot unpack: unsupported type 0x" + to_hex(tag));
+          }
+        }
+      }
+
+      [[nodiscard]] std::size_t position() const noexcept {
+        return pos_;
+      }
+
+    private:
+      static std::string to_hex(const unsigned char c) {
+        constexpr char digits[] = "0123456789abcdef";
+        return { digits[c >> 4], digits[c & 0x0f] };
+      }
+
+      const unsigned char* take(const std::size_t n) {
+        if (n > size_ - pos_) {
+          throw std::runtime_error("cannot unpack: unexpected end of data");
+        }
+        const auto p = data_ + pos_;
+        pos_ += n;
+        return p;
+      }
+
+      void string(const std::size_t len) {
+        const auto p = take(len);
+        lua_pushlstring(L_, reinterpret_cast<const char*>(p), len);
+      }
+
+      void bin(const std::size_t len) {
+        const auto p = take(len);
+        if (source_ != nullptr) {
+          api::push_buffer(L_, source_->slice(static_cast<std::size_t>(p - source_->data()), len));
+        }
+        else {
+          api::push_buffer(L_, api::buffer::copy({ reinterpret_cast<const char*>(p), len }));
+        }
+      }
+
+      void array(const std::size_t count, const int depth) {
+        // every element takes at least one byte. checked before preallocating
+        if (count > size_ - pos_) {
+          throw std::runtime_error("cannot unpack: unexpected end of data");
+        }
+        lua_createtable(L_, static_cast<int>(count), 0);
+        for (std::size_t i = 1; i <= count; ++i) {
+          value(depth + 1);
+          lua_rawseti(L_, -2, static_cast<int>(i));
+        }
+      }
+
+      void map(const std::size_t count, const int depth) {
+        if (count > (size_ - pos_) / 2) {
+          throw std::runtime_error("cannot unpack: unexpected end of data");
+        }
+        lua_createtable(L_, 0, static_cast<int>(count));
+        for (std::size_t i = 0; i < count; ++i) {
+          value(depth + 1);
+          value(depth + 1);
+          if (lua_isnil(L_, -2)) {
+            throw std::runtime_error("cannot unpack: nil map key");
+          }
+          lua_rawset(L_, -3);
+        }
+      }
+
+      lua_State* L_;
+      const unsigned char* data_;
+      std::size_t size_;
+      std::size_t pos_;
+      const api::buffer* source_;
+    };
+  }
+
+  void pack(lua_State* L, const int index, std::string& out, const pack_options& opts) {
+    writer w(L, out, nullptr, opts);
+    w.value(index, 0);
+  }
+
+  std::size_t pack(lua_State* L, const int index, std::FILE* file, const pack_options& opts) {
+    std::string chunk;
+    chunk.reserve(kChunkSize * 2);
+    writer w(L, chunk, file, opts);
+    w.value(index, 0);
+    w.flush(true);
+    return w.written();
+  }
+
+  std::size_t unpack(lua_State* L, const std::string_view bytes, const std::size_t offset, const api::buffer* source) {
+    if (offset > std::size(bytes)) {
+      throw std::runtime_error("cannot unpack: offset is out of data");
+    }
+    reader r(L, bytes, offset, source);
+    r.value(0);
+    return r.position();
+  }
+}
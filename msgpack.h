@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <cstdio>
+#include <cstddef>
+#include <string_view>
+
+#include "include/buffer.hpp"
+
+/*
+ * MessagePack encoding of lua values straight from and to the lua stack.
+ * Tables with keys 1..n are arrays, other tables are maps. Integral numbers use the smallest int format.
+ * Buffers are packed as bin and unpacked as slices of the source buffer without copying.
+ */
+namespace rostrum::msgpack {
+
+  struct pack_options {
+    bool detect_cycles = false;
+  };
+
+  // append value at @index to @out
+  void pack(lua_State* L, int index, std::string& out, const pack_options& opts);
+
+  // stream value at @index to @file in chunks. returns number of written bytes
+  std::size_t pack(lua_State* L, int index, std::FILE* file, const pack_options& opts);
+
+  // push value decoded at @offset. @source, if not null, owns @bytes and bin values are returned as its slices.
+  // returns offset after the value
+  std::size_t unpack(lua_State* L, std::string_view bytes, std::size_t offset, const api::buffer* source);
+}
@@ -0,0 +1,145 @@
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+#include "profiler.h"
+
+namespace rostrum {
+  profiler& profiler::get_instance() {
+    static profiler instance;
+    return instance;
+  }
+
+  void profiler::start(lua_State* L, const options& opts) {
+    std::scoped_lock lock(mutex_);
+
+    if (state_ != nullptr) {
+      throw std::runtime_error("profiler is already running");
+    }
+    if (opts.interval_ms <= 0 || opts.depth <= 0) {
+      throw std::invalid_argument("profiler interval and depth must be positive");
+    }
+
+    options_ = opts;
+    names_.clear();
+    stacks_.clear();
+    samples_ = 0;
+    collect_names(L);
+
+    state_ = L;
+
+    const auto mode = "i" + std::to_string(opts.interval_ms);
+    luaJIT_profile_start(L, mode.c_str(), &profiler::sample, this);
+    spdlog::debug("profiler started with {} ms interval", opts.interval_ms);
+  }
+
+  profiler::stats profiler::stop(const std::string& path) {
+    std::scoped_lock lock(mutex_);
+
+    if (state_ == nullptr) {
+      throw std::runtime_error("profiler is not running");
+    }
+    luaJIT_profile_stop(state_);
+    state_ = nullptr;
+
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error("cannot open profile output '" + path + '\'');
+    }
+
+    // sorted output is stable between runs and diffable
+    std::vector<std::pair<std::string, std::uint64_t>> stacks(std::begin(stacks_), std::end(stacks_));
+    std::sort(std::begin(stacks), std::end(stacks));
+    for (const auto& [stack, count] : stacks) {
+      out << stack << ' ' << count << '\n';
+    }
+
+    spdlog::debug("profiler stopped: {} samples of {} stacks written to '{}'", samples_, std::size(stacks), path);
+    return { samples_, std::size(stacks) };
+  }
+
+  // name native functions found in loaded modules, globals and their tables
+  void profiler::collect_names(lua_State* L) {
+    const auto collect_table = [this, L](const std::string& prefix) {
+      // table is on top of the stack
+      lua_pushnil(L);
+      while (lua_next(L, -2) != 0) {
+        if (lua_type(L, -2) == LUA_TSTRING && lua_iscfunction(L, -1)) {
+          names_.try_emplace(lua_topointer(L, -1), prefix + lua_tostring(L, -2));
+        }
+        lua_pop(L, 1);
+      }
+    };
+
+    luaL_checkstack(L, 6, "profiler");
+
+    lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+    if (lua_istable(L, -1)) {
+      lua_pushnil(L);
+      while (lua_next(L, -2) != 0) {
+        if (lua_type(L, -2) == LUA_TSTRING && lua_istable(L, -1)) {
+          collect_table(std::string(lua_tostring(L, -2)) + '.');
+        }
+        lua_pop(L, 1);
+      }
+    }
+    lua_pop(L, 1);
+
+    lua_pushvalue(L, LUA_GLOBALSINDEX);
+    collect_table("");
+    lua_pop(L, 1);
+  }
+
+  std::string profiler::frame_name(lua_State* L, lua_Debug& ar) {
+    lua_getinfo(L, "nSf", &ar);
+    const auto function = lua_topointer(L, -1);
+    lua_pop(L, 1);
+
+    if (ar.what[0] == 'C') {
+      const auto it = names_.find(function);
+      if (it != std::end(names_)) {
+        return it->second;
+      }
+      return ar.name != nullptr ? std::string("[C] ") + ar.name : "[C]";
+    }
+
+    // lua function. semicolons separate frames in collapsed output
+    auto name = std::string(ar.name != nullptr ? ar.name : ar.what[0] == 'm' ? "main" : "?") + " (" + ar.short_src + ':' + std::to_string(ar.linedefined) + ')';
+    std::replace(std::begin(name), std::end(name), ';', ':');
+    return name;
+  }
+
+  // called by LuaJIT on safe points of the profiled state
+  void profiler::sample(void* data, lua_State* L, const int samples, const int vmstate) {
+    auto& self = *static_cast<profiler*>(data);
+
+    auto& frames = self.frames_;
+    frames.clear();
+    lua_Debug ar;
+    for (auto level = 0; level < self.options_.depth && lua_getstack(L, level, &ar) != 0; ++level) {
+      frames.push_back(self.frame_name(L, ar));
+    }
+
+    auto& key = self.key_;
+    key.clear();
+    for (auto it = std::rbegin(frames); it != std::rend(frames); ++it) {
+      if (!key.empty()) {
+        key += ';';
+      }
+      key += *it;
+    }
+
+    if (self.options_.vm_states && (vmstate == 'G' || vmstate == 'J')) {
+      key += vmstate == 'G' ? ";[gc]" : ";[jit compiler]";
+    }
+    if (key.empty()) {
+      key = "[idle]";
+    }
+
+    self.stacks_[key] += static_cast<std::uint64_t>(samples);
+    self.samples_ += static_cast<std::uint64_t>(samples);
+  }
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "include/api.hpp"
+
+namespace rostrum {
+  /*
+   * Sampling profiler of lua code built on LuaJIT profiler API.
+   * Samples are aggregated by stack and written in collapsed format ("root;...;leaf count") for flamegraph tools.
+   * LuaJIT supports one running profiler per process.
+   */
+  class profiler final {
+  public:
+    struct options {
+      int interval_ms = 10;
+      int depth = 64;
+      // add frame for samples taken in gc or jit compiler
+      bool vm_states = true;
+    };
+
+    struct stats {
+      std::uint64_t samples;
+      std::size_t stacks;
+    };
+
+  private:
+    profiler() = default;
+
+  public:
+    static profiler& get_instance();
+
+    void start(lua_State* L, const options& opts);
+
+    // stop profiling and write collapsed stacks to @path
+    stats stop(const std::string& path);
+
+    [[nodiscard]] bool running() const noexcept {
+      return state_ != nullptr;
+    }
+
+  private:
+    static void sample(void* data, lua_State* L, int samples, int vmstate);
+
+    void collect_names(lua_State* L);
+    std::string frame_name(lua_State* L, lua_Debug& ar);
+
+    std::mutex mutex_;
+    lua_State* state_{ nullptr };
+    options options_;
+
+    // native functions are named by table they were found in, e.g. ":core.submit"
+    std::unordered_map<const void*, std::string> names_;
+    std::unordered_map<std::string, std::uint64_t> stacks_;
+    std::uint64_t samples_{ 0 };
+
+    // reused by sample to not allocate on every call
+    std::vector<std::string> frames_;
+    std::string key_;
+  };
+}
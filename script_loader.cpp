@@ -0,0 +1,58 @@
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+#include "script_loader.h"
+#include "mapped_file.h"
+#include "bytecode_cache.h"
+
+namespace rostrum {
+  namespace {
+    // size of blocks handed to the parser. small enough to be hashed while still in cache
+    constexpr std::size_t kReadBlockSize = 64 * 1024;
+
+    struct hashing_reader {
+      std::string_view source;
+      XXH3_state_t state;
+
+      static const char* read(lua_State*, void* ud, std::size_t* size) {
+        auto& self = *static_cast<hashing_reader*>(ud);
+        if (self.source.empty()) {
+          *size = 0;
+          return nullptr;
+        }
+
+        const auto block = self.source.substr(0, kReadBlockSize);
+        self.source.remove_prefix(std::size(block));
+        XXH3_128bits_update(&self.state, std::data(block), std::size(block));
+
+        *size = std::size(block);
+        return std::data(block);
+      }
+    };
+  }
+
+  std::string to_hex(const XXH128_hash_t& hash) {
+    return fmt::format("{:016x}{:016x}", hash.high64, hash.low64);
+  }
+
+  sol::load_result load_script(sol::state_view& lua, const std::string& filename, XXH128_hash_t& hash) {
+    const mapped_file file(filename);
+    const auto chunkname = "@" + filename;
+
+    // cache key needs the hash before parsing
+    auto& cache = bytecode_cache::get_instance();
+    if (cache.enabled()) {
+      hash = XXH3_128bits(file.data(), file.size());
+      return cache.load(lua, file.view(), chunkname, hash);
+    }
+
+    // otherwise parse and hash in the same pass
+    lua_State* L = lua.lua_state();
+    hashing_reader reader{ file.view(), {} };
+    XXH3_128bits_reset(&reader.state);
+    const auto status = static_cast<sol::load_status>(lua_load(L, &hashing_reader::read, &reader, chunkname.c_str()));
+    hash = XXH3_128bits_digest(&reader.state);
+    return sol::load_result(L, lua_gettop(L), 1, 1, status);
+  }
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <string>
+
+#include <xxhash.h>
+
+#include "include/api.hpp"
+
+namespace rostrum {
+
+  // lowercase hex of 128 bit hash. lua numbers cannot hold 64+ bit integers
+  [[nodiscard]]
+  std::string to_hex(const XXH128_hash_t& hash);
+
+  /*
+   * Load lua script from memory mapped file without copying it.
+   * Goes through bytecode cache when it is enabled.
+   * @hash receives XXH3-128 of the file content
+   */
+  [[nodiscard]]
+  sol::load_result load_script(sol::state_view& lua, const std::string& filename, XXH128_hash_t& hash);
+}
@@ -0,0 +1,413 @@
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+
+#include "script_runner.h"
+#include "manager.h"
+#include "sol_check.h"
+#include "logging.h"
+#include "script_loader.h"
+#include "budget.h"
+#include "sysinfo.h"
+
+namespace rostrum {
+  namespace {
+    constexpr auto kRunKey = "rostrum.run";
+
+    const script_runner::output* get_output(lua_State* L) {
+      const auto run = get_script_run(L);
+      return run != nullptr ? run->out : nullptr;
+    }
+
+    // print of the base lib writing to the output
+    int print(lua_State* L) {
+      const auto out = get_output(L);
+      const auto n = lua_gettop(L);
+
+      std::string text;
+      lua_getglobal(L, "tostring");
+      for (auto i = 1; i <= n; ++i) {
+        lua_pushvalue(L, -1);
+        lua_pushvalue(L, i);
+        lua_call(L, 1, 1);
+        std::size_t len;
+        const auto s = lua_tolstring(L, -1, &len);
+        if (s == nullptr) {
+          return luaL_error(L, "'tostring' must return a string to 'print'");
+        }
+        if (i > 1) {
+          text.push_back('\t');
+        }
+        text.append(s, len);
+        lua_pop(L, 1);
+      }
+      text.push_back('\n');
+
+      (*out)(text);
+      return 0;
+    }
+
+    // upvalue of replaced io functions: table with redirected stdout, original write and output functions
+    // and selected flag set once the script selects another default output
+    constexpr auto kRedirect = lua_upvalueindex(1);
+
+    bool other_output_selected(lua_State* L) {
+      lua_getfield(L, kRedirect, "selected");
+      const auto selected = lua_toboolean(L, -1) != 0;
+      lua_pop(L, 1);
+      return selected;
+    }
+
+    // call original io function @name with all arguments
+    int call_original(lua_State* L, const char* name) {
+      const auto n = lua_gettop(L);
+      lua_getfield(L, kRedirect, name);
+      lua_insert(L, 1);
+      lua_call(L, n, LUA_MULTRET);
+      return lua_gettop(L);
+    }
+
+    // write values from @first on to the output as io.write does
+    void write_values(lua_State* L, const int first) {
+      const auto out = get_output(L);
+      const auto n = lua_gettop(L);
+
+      std::string text;
+      for (auto i = first; i <= n; ++i) {
+        if (lua_type(L, i) == LUA_TNUMBER) {
+          char number[32];
+          const auto len = std::snprintf(number, sizeof(number), LUA_NUMBER_FMT, lua_tonumber(L, i));
+          text.append(number, static_cast<std::size_t>(len));
+        }
+        else {
+          std::size_t len;
+          const auto s = luaL_checklstring(L, i, &len);
+          text.append(s, len);
+        }
+      }
+
+      (*out)(text);
+    }
+
+    // io.write to default output, which is stdout of the script unless io.output selected another file
+    int io_write(lua_State* L) {
+      if (other_output_selected(L)) {
+        return call_original(L, "write");
+      }
+      write_values(L, 1);
+      lua_pushboolean(L, 1);
+      return 1;
+    }
+
+    // io.output returns redirected stdout until the script selects another file
+    int io_output(lua_State* L) {
+      if (lua_isnoneornil(L, 1)) {
+        if (other_output_selected(L)) {
+          return call_original(L, "output");
+        }
+        lua_getfield(L, kRedirect, "stdout");
+        return 1;
+      }
+
+      lua_getfield(L, kRedirect, "stdout");
+      const auto redirected = lua_rawequal(L, 1, -1) != 0;
+      lua_pop(L, 1);
+      lua_pushboolean(L, !redirected);
+      lua_setfield(L, kRedirect, "selected");
+      if (redirected) {
+        lua_settop(L, 1);
+        return 1;
+      }
+      return call_original(L, "output");
+    }
+
+    // methods of redirected io.stdout
+    int stdout_write(lua_State* L) {
+      write_values(L, 2);
+      lua_pushboolean(L, 1);
+      return 1;
+    }
+
+    int stdout_flush(lua_State* L) {
+      lua_pushboolean(L, 1);
+      return 1;
+    }
+
+    int stdout_close(lua_State* L) {
+      lua_pushnil(L);
+      lua_pushliteral(L, "cannot close standard file");
+      return 2;
+    }
+
+    const luaL_Reg stdout_methods[] = {
+      { "write", stdout_write },
+      { "flush", stdout_flush },
+      { "setvbuf", stdout_flush },
+      { "close", stdout_close },
+      { nullptr, nullptr }
+    };
+
+    // replace io.write with output of the running script if there is one
+    void redirect_io(lua_State* L) {
+      if (get_output(L) == nullptr) {
+        return;
+      }
+      lua_getglobal(L, "io");
+      if (!lua_istable(L, -1)) {
+        lua_pop(L, 1);
+        return;
+      }
+      const auto io = lua_gettop(L);
+      luaL_checkstack(L, 4, "redirect_io");
+
+      lua_newtable(L);
+      const auto redirect = lua_gettop(L);
+      lua_getfield(L, io, "write");
+      lua_setfield(L, redirect, "write");
+      lua_getfield(L, io, "output");
+      lua_setfield(L, redirect, "output");
+
+      // io.stdout is replaced by a file-like table, so io.stdout:write and io.output():write reach the output too
+      lua_newtable(L);
+      for (auto method = stdout_methods; method->name != nullptr; ++method) {
+        lua_pushcfunction(L, method->func);
+        lua_setfield(L, -2, method->name);
+      }
+      lua_pushvalue(L, -1);
+      lua_setfield(L, redirect, "stdout");
+      lua_setfield(L, io, "stdout");
+
+      lua_pushvalue(L, redirect);
+      lua_pushcclosure(L, io_write, 1);
+      lua_setfield(L, io, "write");
+      lua_pushvalue(L, redirect);
+      lua_pushcclosure(L, io_output, 1);
+      lua_setfield(L, io, "output");
+
+      lua_settop(L, io - 1);
+    }
+
+    // upvalues: original function and number of leading path arguments, which resolve against cwd of the job
+    int with_scoped_paths(lua_State* L) {
+      const auto run = get_script_run(L);
+      const auto count = static_cast<int>(lua_tointeger(L, lua_upvalueindex(2)));
+      for (auto i = 1; i <= count && run != nullptr; ++i) {
+        if (lua_type(L, i) != LUA_TSTRING) {
+          continue;
+        }
+        std::string resolved;
+        if (const std::filesystem::path path(lua_tostring(L, i)); path.is_relative()) {
+          resolved = (std::filesystem::path(run->cwd) / path).string();
+        }
+        if (!resolved.empty()) {
+          lua_pushlstring(L, std::data(resolved), std::size(resolved));
+          lua_replace(L, i);
+        }
+      }
+
+      const auto n = lua_gettop(L);
+      lua_pushvalue(L, lua_upvalueindex(1));
+      lua_insert(L, 1);
+      lua_call(L, n, LUA_MULTRET);
+      return lua_gettop(L);
+    }
+
+    // wrap function @name of global table @table, or global function if nullptr
+    void scope_paths(lua_State* L, const char* table, const char* name, const int count) {
+      if (table != nullptr) {
+        lua_getglobal(L, table);
+      }
+      else {
+        lua_pushvalue(L, LUA_GLOBALSINDEX);
+      }
+      if (lua_istable(L, -1)) {
+        lua_getfield(L, -1, name);
+        if (lua_isfunction(L, -1)) {
+          lua_pushinteger(L, count);
+          lua_pushcclosure(L, with_scoped_paths, 2);
+          lua_setfield(L, -2, name);
+        }
+        else {
+          lua_pop(L, 1);
+        }
+      }
+      lua_pop(L, 1);
+    }
+
+    // relative templates of package.path and package.cpath resolve against @cwd
+    void scope_package_paths(lua_State* L, const std::string& cwd) {
+      lua_getglobal(L, "package");
+      if (!lua_istable(L, -1)) {
+        lua_pop(L, 1);
+        return;
+      }
+      for (const auto field : { "path", "cpath" }) {
+        lua_getfield(L, -1, field);
+        if (const auto paths = lua_tostring(L, -1)) {
+          std::string scoped;
+          const std::string_view all(paths);
+          for (std::size_t begin = 0; begin <= std::size(all);) {
+            const auto end = (std::min)(all.find(LUA_PATHSEP[0], begin), std::size(all));
+            const auto tpl = std::string(all.substr(begin, end - begin));
+            if (begin != 0) {
+              scoped += LUA_PATHSEP;
+            }
+            scoped += !tpl.empty() && std::filesystem::path(tpl).is_relative() ? (std::filesystem::path(cwd) / tpl).string() : tpl;
+            begin = end + 1;
+          }
+          lua_pushlstring(L, std::data(scoped), std::size(scoped));
+          lua_setfield(L, -3, field);
+        }
+        lua_pop(L, 1);
+      }
+      lua_pop(L, 1);
+    }
+
+    // ends the script instead of the process. exit code is kept even if the error is caught by pcall
+    int os_exit(lua_State* L) {
+      auto code = EXIT_SUCCESS;
+      if (lua_isboolean(L, 1)) {
+        code = lua_toboolean(L, 1) != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+      else {
+        code = static_cast<int>(luaL_optinteger(L, 1, EXIT_SUCCESS));
+      }
+      if (const auto run = get_script_run(L)) {
+        run->exit_code = code;
+      }
+      return luaL_error(L, "os.exit(%d)", code);
+    }
+  }
+
+  script_run* get_script_run(lua_State* L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, kRunKey);
+    const auto run = static_cast<script_run*>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    return run;
+  }
+
+  void isolate_lib(lua_State* L, const sol::lib lib) {
+    const auto run = get_script_run(L);
+    if (run == nullptr) {
+      return;
+    }
+    const auto scoped = !run->cwd.empty();
+
+    switch (lib) {
+    case sol::lib::base:
+      if (run->out != nullptr) {
+        lua_register(L, "print", print);
+      }
+      if (scoped) {
+        scope_paths(L, nullptr, "dofile", 1);
+        scope_paths(L, nullptr, "loadfile", 1);
+      }
+      break;
+    case sol::lib::io:
+      redirect_io(L);
+      if (scoped) {
+        for (const auto name : { "open", "lines", "input", "output" }) {
+          scope_paths(L, "io", name, 1);
+        }
+      }
+      break;
+    case sol::lib::os:
+      lua_getglobal(L, "os");
+      if (lua_istable(L, -1)) {
+        lua_pushcfunction(L, os_exit);
+        lua_setfield(L, -2, "exit");
+      }
+      lua_pop(L, 1);
+      if (scoped) {
+        scope_paths(L, "os", "remove", 1);
+        scope_paths(L, "os", "rename", 2);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  script_runner::script_runner() = default;
+
+  script_runner::~script_runner() = default;
+
+  void script_runner::prepare() {
+    if (next_) {
+      return;
+    }
+    auto modules = std::make_unique<module_refs>();
+    auto lua = std::make_unique<sol::state>();
+    manager::get_instance().init_state(*lua, *modules);
+    next_modules_ = std::move(modules);
+    next_ = std::move(lua);
+  }
+
+  script_result script_runner::run(const script_job& job, const output& out, const log_output& log) {
+    const auto begin = std::chrono::steady_clock::now();
+    prepare();
+
+    // outlives the state, whose finalizers may still print or log
+    script_run run{ out ? &out : nullptr, job.cwd, spdlog::level::trace, {}, {} };
+    // drained before run returns, so callers see every record of the script
+    std::optional<logging::scoped_log_route> route;
+    if (log) {
+      route.emplace([&run, &log](const spdlog::level::level_enum level, const std::string_view text) {
+        if (level >= run.log_level.load(std::memory_order_relaxed)) {
+          log(level, text);
+        }
+      });
+    }
+
+    // state is closed before its module libraries are released
+    const auto modules = std::move(next_modules_);
+    const auto lua = std::move(next_);
+    lua_State* L = lua->lua_state();
+
+    lua_pushlightuserdata(L, &run);
+    lua_setfield(L, LUA_REGISTRYINDEX, kRunKey);
+    // libs opened by init_state. others are isolated when the script opens them
+    isolate_lib(L, sol::lib::base);
+    if (!job.cwd.empty()) {
+      scope_package_paths(L, job.cwd);
+    }
+
+    // state may have been initialized long ago
+    budget::reset(L);
+
+    script_result result{ EXIT_SUCCESS, {}, {} };
+    const auto script_path = job.cwd.empty() ? job.script : (std::filesystem::path(job.cwd) / job.script).string();
+    try {
+      XXH128_hash_t script_hash;
+      auto script = sol_check(load_script(*lua, script_path, script_hash));
+      spdlog::debug("loaded script '{}' ({})", script_path, to_hex(script_hash));
+      sol_check(script(job.args));
+    }
+    catch (const std::exception& e) {
+      if (!run.exit_code) {
+        spdlog::critical(e.what());
+        result.exit_code = EXIT_FAILURE;
+        result.error = e.what();
+      }
+    }
+    if (run.exit_code) {
+      result.exit_code = *run.exit_code;
+    }
+
+    // runner thread serves the next script
+    if (run.affinity) {
+      try {
+        sysinfo::set_thread_affinity(*run.affinity);
+      }
+      catch (const std::exception& e) {
+        spdlog::warn("cannot restore thread affinity after '{}': {}", script_path, e.what());
+      }
+    }
+
+    result.elapsed = std::chrono::steady_clock::now() - begin;
+    return result;
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <functional>
+#include <string_view>
+
+#include <spdlog/common.h>
+
+#include "include/api.hpp"
+#include "manager.h"
+
+namespace rostrum {
+  struct script_job {
+    std::string script;
+    std::vector<std::string> args;
+    // relative paths of the job resolve against it, e.g. working directory of a serve client. empty for own one
+    std::string cwd;
+  };
+
+  struct script_result {
+    int exit_code;
+    std::string error;
+    std::chrono::nanoseconds elapsed;
+  };
+
+  /*
+   * Runs scripts like a cold start of the host, each in a fresh state sharing loaded rostrum modules.
+   * The next state is initialized ahead by prepare, so run only pays for loading and executing the script.
+   * Process-wide effects a cold start may have are scoped to the run, see script_run.
+   * Not thread safe: one runner per thread.
+   */
+  class script_runner final {
+  public:
+    // receives text written by print and io.write of the script
+    using output = std::function<void(std::string_view text)>;
+    // receives formatted records logged by the running thread
+    using log_output = std::function<void(spdlog::level::level_enum level, std::string_view text)>;
+
+    script_runner();
+    ~script_runner();
+
+    void prepare();
+
+    // errors are logged by the running thread and reported in the result
+    script_result run(const script_job& job, const output& out = {}, const log_output& log = {});
+
+  private:
+    std::unique_ptr<module_refs> next_modules_;
+    std::unique_ptr<sol::state> next_;
+  };
+
+  /*
+   * Settings of a script run by script_runner which a cold start would apply to the whole process.
+   * os.exit ends the script with its exit code, core.set_log_level filters its log route,
+   * core.set_thread_affinity is undone after the run and relative paths resolve against the job's cwd.
+   */
+  struct script_run {
+    const script_runner::output* out;
+    std::string cwd;
+    // read by the logger thread
+    std::atomic<spdlog::level::level_enum> log_level;
+    std::optional<int> exit_code;
+    // affinity of the runner thread before the script changed it
+    std::optional<std::vector<std::size_t>> affinity;
+  };
+
+  // run of the script in @L. nullptr for a cold start
+  [[nodiscard]]
+  script_run* get_script_run(lua_State* L);
+
+  // scope functions of @lib to the running script: output, os.exit and relative paths. called when a lib is opened
+  void isolate_lib(lua_State* L, sol::lib lib);
+}
@@ -0,0 +1,377 @@
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <csignal>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <optional>
+#include <stdexcept>
+#include <filesystem>
+#include <condition_variable>
+
+#ifdef _WIN32
+# include <winsock2.h>
+# include <afunix.h>
+#else
+# include <poll.h>
+# include <unistd.h>
+# include <sys/un.h>
+# include <sys/socket.h>
+#endif
+
+#include "serve.h"
+#include "logging.h"
+
+namespace rostrum::serve {
+  namespace {
+#ifdef _WIN32
+    using native_socket = SOCKET;
+    constexpr native_socket kInvalidSocket = INVALID_SOCKET;
+    constexpr auto kSendFlags = 0;
+
+    void close_socket(const native_socket s) {
+      closesocket(s);
+    }
+
+    int poll_socket(pollfd* fd, const int timeout_ms) {
+      return WSAPoll(fd, 1, timeout_ms);
+    }
+
+    // winsock is initialized once per process
+    void init_sockets() {
+      static const auto initialized = [] {
+        WSADATA data;
+        if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+          throw std::runtime_error("cannot initialize winsock");
+        }
+        return true;
+      }();
+      (void)initialized;
+    }
+#else
+    using native_socket = int;
+    constexpr native_socket kInvalidSocket = -1;
+# ifdef MSG_NOSIGNAL
+    // disconnected clients must not kill the server with SIGPIPE
+    constexpr auto kSendFlags = MSG_NOSIGNAL;
+# else
+    constexpr auto kSendFlags = 0;
+# endif
+
+    void close_socket(const native_socket s) {
+      ::close(s);
+    }
+
+    int poll_socket(pollfd* fd, const int timeout_ms) {
+      return ::poll(fd, 1, timeout_ms);
+    }
+
+    void init_sockets() {
+    }
+#endif
+
+    constexpr auto kMaxPayload = std::uint32_t{ 64 } * 1024 * 1024;
+
+    class connection final {
+    public:
+      explicit connection(const native_socket s) noexcept : socket_(s) {
+      }
+
+      connection(const connection&) = delete;
+      connection& operator= (const connection&) = delete;
+
+      ~connection() {
+        if (socket_ != kInvalidSocket) {
+          close_socket(socket_);
+        }
+      }
+
+      // frames are sent from script and logger threads. fails silently once the peer is gone
+      void send(const frame_type type, const std::string_view payload) {
+        char header[5];
+        header[0] = static_cast<char>(type);
+        const auto size = static_cast<std::uint32_t>(std::size(payload));
+        for (auto i = 0; i < 4; ++i) {
+          header[1 + i] = static_cast<char>(size >> (8 * i));
+        }
+
+        std::scoped_lock lock(mutex_);
+        if (!broken_) {
+          broken_ = !send_all(header, sizeof(header)) || !send_all(std::data(payload), std::size(payload));
+        }
+      }
+
+      // false if connection is closed before the whole frame
+      bool receive(frame_type& type, std::string& payload) {
+        unsigned char header[5];
+        if (!receive_all(reinterpret_cast<char*>(header), sizeof(header))) {
+          return false;
+        }
+        type = static_cast<frame_type>(header[0]);
+        std::uint32_t size = 0;
+        for (auto i = 0; i < 4; ++i) {
+          size |= static_cast<std::uint32_t>(header[1 + i]) << (8 * i);
+        }
+        if (size > kMaxPayload) {
+          throw std::runtime_error("frame is too large");
+        }
+        payload.resize(size);
+        return receive_all(std::data(payload), size);
+      }
+
+    private:
+      bool send_all(const char* data, std::size_t size) const {
+        while (size > 0) {
+          const auto n = ::send(socket_, data, static_cast<int>(size), kSendFlags);
+          if (n <= 0) {
+            return false;
+          }
+          data += n;
+          size -= static_cast<std::size_t>(n);
+        }
+        return true;
+      }
+
+      bool receive_all(char* data, std::size_t size) const {
+        while (size > 0) {
+          const auto n = ::recv(socket_, data, static_cast<int>(size), 0);
+          if (n <= 0) {
+            return false;
+          }
+          data += n;
+          size -= static_cast<std::size_t>(n);
+        }
+        return true;
+      }
+
+      native_socket socket_;
+      std::mutex mutex_;
+      bool broken_{ false };
+    };
+
+    sockaddr_un make_address(const std::string& path) {
+      sockaddr_un address{};
+      address.sun_family = AF_UNIX;
+      if (std::size(path) >= sizeof(address.sun_path)) {
+        throw std::runtime_error("socket path '" + path + "' is too long");
+      }
+      std::memcpy(address.sun_path, path.c_str(), std::size(path) + 1);
+      return address;
+    }
+
+    std::atomic<bool> stop_requested{ false };
+
+    extern "C" void request_stop(int) {
+      stop_requested.store(true);
+    }
+
+    /*
+     * Workers waiting for accepted connections. Each owns a runner with the next state initialized ahead.
+     */
+    class server final {
+    public:
+      explicit server(const std::size_t workers) {
+        for (std::size_t i = 0; i < workers; ++i) {
+          threads_.emplace_back(&server::worker_loop, this);
+        }
+      }
+
+      ~server() {
+        {
+          std::scoped_lock lock(mutex_);
+          stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : threads_) {
+          t.join();
+        }
+      }
+
+      void post(std::unique_ptr<connection> c) {
+        {
+          std::scoped_lock lock(mutex_);
+          pending_.push_back(std::move(c));
+        }
+        cv_.notify_one();
+      }
+
+    private:
+      std::unique_ptr<connection> take() {
+        std::unique_lock lock(mutex_);
+        cv_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+        if (pending_.empty()) {
+          return nullptr;
+        }
+        auto c = std::move(pending_.front());
+        pending_.pop_front();
+        return c;
+      }
+
+      static void serve_client(script_runner& runner, connection& c) {
+        frame_type type;
+        std::string payload;
+        if (!c.receive(type, payload) || type != frame_type::request) {
+          spdlog::warn("serve: dropped client without request");
+          return;
+        }
+
+        std::vector<std::string> fields;
+        std::size_t begin = 0;
+        for (auto end = payload.find('\0'); ; end = payload.find('\0', begin)) {
+          fields.push_back(payload.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+          if (end == std::string::npos) {
+            break;
+          }
+          begin = end + 1;
+        }
+        if (std::size(fields) < 2 || fields[0].empty() || fields[1].empty()) {
+          spdlog::warn("serve: dropped client with malformed request");
+          return;
+        }
+
+        script_job job;
+        job.cwd = std::move(fields[0]);
+        job.script = std::move(fields[1]);
+        job.args.assign(std::make_move_iterator(std::begin(fields) + 2), std::make_move_iterator(std::end(fields)));
+
+        // log route is drained before run returns, so the exit frame is the last one
+        const auto result = runner.run(job, [&c](const std::string_view text) {
+          c.send(frame_type::output, text);
+        }, [&c](spdlog::level::level_enum, const std::string_view text) {
+          c.send(frame_type::log, text);
+        });
+        spdlog::debug("serve: '{}' exited with {} in {} us", job.script, result.exit_code,
+          std::chrono::duration_cast<std::chrono::microseconds>(result.elapsed).count());
+
+        char code[4];
+        for (auto i = 0; i < 4; ++i) {
+          code[i] = static_cast<char>(static_cast<std::uint32_t>(result.exit_code) >> (8 * i));
+        }
+        c.send(frame_type::exit, std::string_view(code, sizeof(code)));
+      }
+
+      void worker_loop() {
+        script_runner runner;
+        runner.prepare();
+        while (const auto c = take()) {
+          try {
+            serve_client(runner, *c);
+          }
+          catch (const std::exception& e) {
+            spdlog::warn("serve: client failed: {}", e.what());
+          }
+          runner.prepare();
+        }
+      }
+
+      std::mutex mutex_;
+      std::condition_variable cv_;
+      std::deque<std::unique_ptr<connection>> pending_;
+      bool stop_{ false };
+      std::vector<std::thread> threads_;
+    };
+  }
+
+  void run_server(const std::string& socket_path, const std::size_t workers) {
+    init_sockets();
+
+    const auto address = make_address(socket_path);
+    const auto listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == kInvalidSocket) {
+      throw std::runtime_error("cannot create server socket");
+    }
+    const connection listener_guard(listener);
+
+    // socket file of a previous server is replaced. any other file is left alone
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    if (const auto status = fs::symlink_status(socket_path, ec); fs::exists(status)) {
+      if (!fs::is_socket(status)) {
+        throw std::runtime_error("cannot listen on '" + socket_path + "': file exists and is not a socket");
+      }
+      fs::remove(socket_path, ec);
+    }
+    if (::bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listener, SOMAXCONN) != 0) {
+      throw std::runtime_error("cannot listen on '" + socket_path + "'");
+    }
+
+    std::signal(SIGINT, request_stop);
+    std::signal(SIGTERM, request_stop);
+    spdlog::info("serving on '{}' with {} workers", socket_path, workers);
+    {
+      server s(workers);
+      while (!stop_requested.load()) {
+        pollfd fd{};
+        fd.fd = listener;
+        fd.events = POLLIN;
+        if (poll_socket(&fd, 500) <= 0) {
+          continue;
+        }
+        const auto client = ::accept(listener, nullptr, nullptr);
+        if (client != kInvalidSocket) {
+          s.post(std::make_unique<connection>(client));
+        }
+      }
+    }
+
+    if (fs::is_socket(fs::symlink_status(socket_path, ec))) {
+      fs::remove(socket_path, ec);
+    }
+    spdlog::info("server on '{}' stopped", socket_path);
+  }
+
+  int run_client(const std::string& socket_path, const script_job& job) {
+    init_sockets();
+
+    // server resolves relative paths of the script against working directory of the client
+    auto payload = std::filesystem::current_path().string();
+    payload.push_back('\0');
+    payload += job.script;
+    for (const auto& arg : job.args) {
+      payload.push_back('\0');
+      payload += arg;
+    }
+
+    const auto address = make_address(socket_path);
+    const auto s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == kInvalidSocket) {
+      throw std::runtime_error("cannot create client socket");
+    }
+    connection c(s);
+    if (::connect(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+      throw std::runtime_error("cannot connect to '" + socket_path + "'");
+    }
+    c.send(frame_type::request, payload);
+
+    frame_type type;
+    std::string frame;
+    while (c.receive(type, frame)) {
+      switch (type) {
+      case frame_type::output:
+        std::fwrite(std::data(frame), 1, std::size(frame), stdout);
+        break;
+      case frame_type::log:
+        std::fwrite(std::data(frame), 1, std::size(frame), stderr);
+        break;
+      case frame_type::exit: {
+        if (std::size(frame) != 4) {
+          throw std::runtime_error("malformed exit frame");
+        }
+        std::uint32_t code = 0;
+        for (auto i = 0; i < 4; ++i) {
+          code |= static_cast<std::uint32_t>(static_cast<unsigned char>(frame[i])) << (8 * i);
+        }
+        std::fflush(stdout);
+        return static_cast<int>(code);
+      }
+      default:
+        throw std::runtime_error("unexpected frame type " + std::to_string(static_cast<int>(type)));
+      }
+    }
+    throw std::runtime_error("server closed connection before script finished");
+  }
+}
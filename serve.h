@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+#include "script_runner.h"
+
+/*
+ * Warm host daemon. Server keeps rostrum modules loaded and a pre-initialized state per worker,
+ * clients send script path and args over a unix socket and receive its output, logs and exit code.
+ * Frame: u8 type, u32 little endian payload length, payload.
+ */
+namespace rostrum::serve {
+
+  enum class frame_type : std::uint8_t {
+    // working directory of the client, script path and args separated by '\0'
+    request = 1,
+    // text printed by the script
+    output,
+    // formatted log record of the script
+    log,
+    // i32 little endian exit code. last frame
+    exit
+  };
+
+  // serve until SIGINT or SIGTERM
+  void run_server(const std::string& socket_path, std::size_t workers);
+
+  // run @job on server. returns exit code of the script
+  [[nodiscard]]
+  int run_client(const std::string& socket_path, const script_job& job);
+}
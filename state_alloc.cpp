@@ -0,0 +1,95 @@
+#include <new>
+
+#include "state_alloc.h"
+
+namespace rostrum::alloc {
+  namespace {
+    constexpr auto kSentinelKey = "rostrum.alloc";
+
+    void observe(context& c, void* ptr, void* p, const std::size_t osize, const std::size_t nsize) {
+      if (ptr != nullptr && ptr != p && c.filter.may_contain(ptr)) {
+        if (p == nullptr) {
+          c.sampler->freed(ptr);
+        }
+        else {
+          c.filter.insert(p);
+          c.sampler->moved(ptr, p);
+        }
+      }
+      if (nsize <= osize) {
+        return;
+      }
+
+      // grown bytes count towards the next sample. weight keeps the estimate unbiased for large blocks
+      const auto grown = nsize - osize;
+      if (grown < c.sample_countdown) {
+        c.sample_countdown -= grown;
+        return;
+      }
+      const auto intervals = 1 + (grown - c.sample_countdown) / c.sample_interval;
+      c.sample_countdown = c.sample_interval - (grown - c.sample_countdown) % c.sample_interval;
+      c.filter.insert(p);
+      c.sampler->sampled(p, nsize, intervals * c.sample_interval);
+    }
+
+    void* allocate(void* ud, void* ptr, const std::size_t osize, const std::size_t nsize) {
+      auto& c = *static_cast<context*>(ud);
+      // osize of new blocks is 0
+      if (nsize > osize && c.hard_limit != 0 && c.bytes + (nsize - osize) > c.hard_limit) {
+        return nullptr;
+      }
+
+      const auto p = c.base(c.base_ud, ptr, osize, nsize);
+      if (p != nullptr || nsize == 0) {
+        c.bytes = c.bytes + nsize - osize;
+        if (c.bytes > c.peak) {
+          c.peak = c.bytes;
+        }
+        if (c.sampler != nullptr) {
+          observe(c, ptr, p, osize, nsize);
+        }
+      }
+      return p;
+    }
+
+    // finalized on lua_close before the state memory is freed. the rest is freed by the base allocator
+    int release(lua_State* L) {
+      void* ud;
+      if (lua_getallocf(L, &ud) == allocate) {
+        const auto c = static_cast<context*>(ud);
+        if (c->sampler != nullptr) {
+          c->sampler->detached();
+        }
+        lua_setallocf(L, c->base, c->base_ud);
+        delete c;
+      }
+      return 0;
+    }
+  }
+
+  context& install(lua_State* L) {
+    if (const auto c = get(L)) {
+      return *c;
+    }
+
+    void* base_ud;
+    const auto base = lua_getallocf(L, &base_ud);
+    const auto bytes = static_cast<std::size_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + static_cast<std::size_t>(lua_gc(L, LUA_GCCOUNTB, 0));
+    const auto c = new context{ base, base_ud, bytes, bytes, 0, nullptr, 0, 0 };
+
+    lua_newuserdata(L, 0);
+    lua_createtable(L, 0, 1);
+    lua_pushcfunction(L, release);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, kSentinelKey);
+
+    lua_setallocf(L, allocate, c);
+    return *c;
+  }
+
+  context* get(lua_State* L) noexcept {
+    void* ud;
+    return lua_getallocf(L, &ud) == allocate ? static_cast<context*>(ud) : nullptr;
+  }
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <bitset>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#include "include/api.hpp"
+
+namespace rostrum::alloc {
+
+  /*
+   * Receives sampled allocations of a state, e.g. memprofile.
+   * Called inside the allocator: must not use the lua state.
+   */
+  class observer {
+  public:
+    virtual ~observer() = default;
+    // @weight is the number of sampled bytes the allocation stands for
+    virtual void sampled(void* ptr, std::size_t size, std::size_t weight) = 0;
+    // freed and moved blocks that may have been sampled, see sample_filter
+    virtual void freed(void* ptr) = 0;
+    virtual void moved(void* from, void* to) = 0;
+    // state is closed while observed
+    virtual void detached() = 0;
+  };
+
+  /*
+   * Addresses of sampled blocks, so most frees skip the observer.
+   * Bits are never cleared by the allocator; the observer rebuilds it from its blocks.
+   */
+  class sample_filter {
+  public:
+    void insert(const void* ptr) noexcept {
+      bits_.set(slot(ptr));
+    }
+
+    [[nodiscard]] bool may_contain(const void* ptr) const noexcept {
+      return bits_.test(slot(ptr));
+    }
+
+    void clear() noexcept {
+      bits_.reset();
+    }
+
+  private:
+    static constexpr std::size_t kBits = 1 << 15;
+
+    static std::size_t slot(const void* ptr) noexcept {
+      // blocks are at least 8 byte aligned
+      const auto hash = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(ptr) >> 3) * 0x9E3779B97F4A7C15ull;
+      return static_cast<std::size_t>(hash >> 49);
+    }
+
+    std::bitset<kBits> bits_;
+  };
+
+  /*
+   * Accounting allocator wrapping the one the lua state was created with.
+   * Installed by manager::init_state. Context is released when the state is closed.
+   */
+  struct context {
+    lua_Alloc base;
+    void* base_ud;
+    // bytes allocated by the state, including those before install
+    std::size_t bytes;
+    std::size_t peak;
+    // growing allocations over it fail with lua memory error. 0 is unlimited
+    std::size_t hard_limit;
+
+    // every sample_interval allocated bytes one allocation is passed to the observer. owned by the state
+    std::unique_ptr<observer> sampler;
+    std::size_t sample_interval;
+    std::size_t sample_countdown;
+    sample_filter filter;
+  };
+
+  context& install(lua_State* L);
+
+  // nullptr if state has no accounting allocator
+  [[nodiscard]]
+  context* get(lua_State* L) noexcept;
+}
@@ -2,20 +2,58 @@
 #include <infoware/infoware.hpp>
 
 #include <string>
+#include <vector>
 #include <sstream>
+#include <cstdint>
+#include <utility>
 
 namespace rostrum::sysinfo {
 
+	const char* cache_type_name(iware::cpu::cache_type_t cache_type) noexcept;
+	const char* architecture_name(iware::cpu::architecture_t architecture) noexcept;
+	const char* endianness_name(iware::cpu::endianness_t endianness) noexcept;
+
+	struct cache {
+		unsigned level;
+		std::size_t size;
+		std::size_t line_size;
+		unsigned associativity;
+		const char* type;
+	};
+
+	/*
+	 * CPU topology. Queried once on first use since some values (e.g. frequency) are slow to get.
+	 */
+	struct topology {
+		std::uint32_t logical;
+		std::uint32_t physical;
+		std::uint32_t packages;
+		std::int64_t frequency;
+		const char* architecture;
+		const char* endianness;
+		std::string model_name;
+		std::string vendor_id;
+		std::vector<cache> caches;
+		// lowercase instruction set name and whether cpu supports it
+		std::vector<std::pair<const char*, bool>> instruction_sets;
+	};
+
+	[[nodiscard]]
+	const topology& get_topology();
+
+	// pin calling thread to logical cpus. throws std::runtime_error
+	void set_thread_affinity(const std::vector<std::size_t>& cpus);
+
+	// logical cpus the calling thread may run on. throws std::runtime_error
+	[[nodiscard]]
+	std::vector<std::size_t> get_thread_affinity();
+
 	inline std::string get_sys_info() {
 		std::stringstream info;
 
-		const char* cache_type_name(const iware::cpu::cache_type_t cache_type) noexcept;
-		const char* architecture_name(const iware::cpu::architecture_t architecture) noexcept;
-		const char* endianness_name(const iware::cpu::endianness_t endianness) noexcept;
-
+		const auto& cpu = get_topology();
 		const auto os_info = iware::system::OS_info();
 		const auto memory = iware::system::memory();
-		const auto quantities = iware::cpu::quantities();
 
 		info << "System information:\n"
 			"  OS:\n"
@@ -30,39 +68,32 @@ namespace rostrum::sysinfo {
 			<< "      Available: " << memory.virtual_available << "B\n"
 			<< "      Total    : " << memory.virtual_total << "B\n" <<
 			"  CPU:\n"
-			<< "    Architecture: " << architecture_name(iware::cpu::architecture()) << '\n'
-			<< "    Frequency: " << iware::cpu::frequency() << " Hz\n"
-			<< "    Endianness: " << endianness_name(iware::cpu::endianness()) << '\n'
-			<< "    Model name: " << iware::cpu::model_name() << '\n'
-			<< "    Vendor ID: " << iware::cpu::vendor_id() << '\n'
+			<< "    Architecture: " << cpu.architecture << '\n'
+			<< "    Frequency: " << cpu.frequency << " Hz\n"
+			<< "    Endianness: " << cpu.endianness << '\n'
+			<< "    Model name: " << cpu.model_name << '\n'
+			<< "    Vendor ID: " << cpu.vendor_id << '\n'
 			<< "  Quantities:\n"
-			<< "    Logical CPUs : " << quantities.logical << '\n'
-			<< "    Physical CPUs: " << quantities.physical << '\n'
-			<< "    CPU packages : " << quantities.packages << '\n'
+			<< "    Logical CPUs : " << cpu.logical << '\n'
+			<< "    Physical CPUs: " << cpu.physical << '\n'
+			<< "    CPU packages : " << cpu.packages << '\n'
 			<< "  Caches:\n";
 
-
-		for (auto i = 1u; i <= 3; ++i) {
-			const auto cache = iware::cpu::cache(i);
-			info << "    L" << i << ":\n"
+		for (const auto& cache : cpu.caches) {
+			info << "    L" << cache.level << ":\n"
 				<< "      Size         : " << cache.size << "B\n"
 				<< "      Line size    : " << cache.line_size << "B\n"
-				<< "      Associativity: " << static_cast<unsigned int>(cache.associativity) << '\n'
-				<< "      Type         : " << cache_type_name(cache.type) << '\n';
+				<< "      Associativity: " << cache.associativity << '\n'
+				<< "      Type         : " << cache.type << '\n';
 		}
 
 		info << std::boolalpha
 			<< "  Instruction set support:\n";
-		for (const auto& [instruction_set, is_supported] : { std::make_pair("3D-now!", iware::cpu::instruction_set_t::s3d_now),
-												std::make_pair("MMX    ", iware::cpu::instruction_set_t::mmx),
-												std::make_pair("SSE    ", iware::cpu::instruction_set_t::sse),
-												std::make_pair("SSE2   ", iware::cpu::instruction_set_t::sse2),
-												std::make_pair("SSE3   ", iware::cpu::instruction_set_t::sse3),
-												std::make_pair("AVX    ", iware::cpu::instruction_set_t::avx) }) {
-			info << "    " << instruction_set << ": " << instruction_set_supported(is_supported) << '\n';
+		for (const auto& [instruction_set, is_supported] : cpu.instruction_sets) {
+			info << "    " << instruction_set << ": " << is_supported << '\n';
 		}
 
 		return info.str();
 	}
 
-}
\ No newline at end of file
+}
@@ -1,5 +1,16 @@
+#include <stdexcept>
+
+#ifdef _WIN32
+# include <Windows.h>
+#else
+# include <pthread.h>
+# include <sched.h>
+#endif
+
 #include "sysinfo.h"
 
+namespace rostrum::sysinfo {
+
 const char* cache_type_name(const iware::cpu::cache_type_t cache_type) noexcept {
 	switch (cache_type) {
 	case iware::cpu::cache_type_t::unified:
@@ -39,4 +50,122 @@ const char* endianness_name(const iware::cpu::endianness_t endianness) noexcept
 	default:
 		return "Unknown";
 	}
-}
\ No newline at end of file
+}
+
+const topology& get_topology() {
+	static const topology cpu = [] {
+		using iware::cpu::instruction_set_t;
+
+		const auto quantities = iware::cpu::quantities();
+
+		topology result{
+			quantities.logical,
+			quantities.physical,
+			quantities.packages,
+			static_cast<std::int64_t>(iware::cpu::frequency()),
+			architecture_name(iware::cpu::architecture()),
+			endianness_name(iware::cpu::endianness()),
+			iware::cpu::model_name(),
+			iware::cpu::vendor_id(),
+			{},
+			{}
+		};
+
+		for (auto i = 1u; i <= 3; ++i) {
+			const auto cache = iware::cpu::cache(i);
+			result.caches.push_back({ i, static_cast<std::size_t>(cache.size), static_cast<std::size_t>(cache.line_size), static_cast<unsigned>(cache.associativity), cache_type_name(cache.type) });
+		}
+
+		for (const auto& [name, instruction_set] : { std::make_pair("3dnow", instruction_set_t::s3d_now),
+												std::make_pair("mmx", instruction_set_t::mmx),
+												std::make_pair("sse", instruction_set_t::sse),
+												std::make_pair("sse2", instruction_set_t::sse2),
+												std::make_pair("sse3", instruction_set_t::sse3),
+												std::make_pair("ssse3", instruction_set_t::ssse3),
+												std::make_pair("sse41", instruction_set_t::sse41),
+												std::make_pair("sse42", instruction_set_t::sse42),
+												std::make_pair("aes", instruction_set_t::aes),
+												std::make_pair("sha", instruction_set_t::sha),
+												std::make_pair("avx", instruction_set_t::avx),
+												std::make_pair("avx2", instruction_set_t::avx2),
+												std::make_pair("fma3", instruction_set_t::fma3),
+												std::make_pair("bmi1", instruction_set_t::bmi1),
+												std::make_pair("bmi2", instruction_set_t::bmi2),
+												std::make_pair("avx512f", instruction_set_t::avx_512_f),
+												std::make_pair("avx512cd", instruction_set_t::avx_512_cd),
+												std::make_pair("avx512vl", instruction_set_t::avx_512_vl),
+												std::make_pair("avx512bw", instruction_set_t::avx_512_bw),
+												std::make_pair("avx512dq", instruction_set_t::avx_512_dq) }) {
+			result.instruction_sets.emplace_back(name, iware::cpu::instruction_set_supported(instruction_set));
+		}
+
+		return result;
+	}();
+	return cpu;
+}
+
+void set_thread_affinity(const std::vector<std::size_t>& cpus) {
+	if (cpus.empty()) {
+		throw std::runtime_error("thread affinity needs at least one cpu");
+	}
+
+#ifdef _WIN32
+	// cpus of the current processor group only
+	DWORD_PTR mask = 0;
+	for (const auto cpu : cpus) {
+		if (cpu >= sizeof(mask) * 8) {
+			throw std::runtime_error("cpu " + std::to_string(cpu) + " is out of affinity mask range");
+		}
+		mask |= DWORD_PTR{ 1 } << cpu;
+	}
+	if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (const auto cpu : cpus) {
+		if (cpu >= CPU_SETSIZE) {
+			throw std::runtime_error("cpu " + std::to_string(cpu) + " is out of affinity mask range");
+		}
+		CPU_SET(cpu, &set);
+	}
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+#endif
+		throw std::runtime_error("cannot set thread affinity");
+	}
+}
+
+std::vector<std::size_t> get_thread_affinity() {
+	std::vector<std::size_t> cpus;
+#ifdef _WIN32
+	// no getter for threads: set the process mask and restore the previous one it returns
+	DWORD_PTR process_mask;
+	DWORD_PTR system_mask;
+	if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) == 0) {
+		throw std::runtime_error("cannot get thread affinity");
+	}
+	const auto mask = SetThreadAffinityMask(GetCurrentThread(), process_mask);
+	if (mask == 0) {
+		throw std::runtime_error("cannot get thread affinity");
+	}
+	SetThreadAffinityMask(GetCurrentThread(), mask);
+	for (std::size_t cpu = 0; cpu < sizeof(mask) * 8; ++cpu) {
+		if ((mask & (DWORD_PTR{ 1 } << cpu)) != 0) {
+			cpus.push_back(cpu);
+		}
+	}
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		throw std::runtime_error("cannot get thread affinity");
+	}
+	for (std::size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, &set)) {
+			cpus.push_back(cpu);
+		}
+	}
+#endif
+	return cpus;
+}
+
+}
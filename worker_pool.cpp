@@ -0,0 +1,210 @@
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <condition_variable>
+
+#include <spdlog/spdlog.h>
+
+#include "manager.h"
+#include "worker_pool.h"
+
+namespace rostrum {
+  class worker_pool::impl {
+  private:
+    struct task {
+      std::string code;
+      std::string chunkname;
+      marshal::values args;
+      std::promise<result> promise;
+    };
+
+    struct worker {
+      std::mutex mutex;
+      std::deque<std::unique_ptr<task>> tasks;
+      std::thread thread;
+    };
+
+    // worker which is running on the current thread if any
+    struct current_worker {
+      impl* pool;
+      std::size_t index;
+      lua_State* L;
+    };
+    inline static thread_local current_worker current_{ nullptr, 0, nullptr };
+
+    std::vector<std::unique_ptr<worker>> workers_;
+    std::atomic<std::size_t> next_{ 0 };
+    std::atomic<std::size_t> pending_{ 0 };
+
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+    bool stop_{ false };
+
+    // owner takes newest tasks from the back, thieves take oldest from the front
+    std::unique_ptr<task> pop(const std::size_t index) {
+      auto& w = *workers_[index];
+      std::scoped_lock lock(w.mutex);
+      if (w.tasks.empty()) {
+        return nullptr;
+      }
+      auto t = std::move(w.tasks.back());
+      w.tasks.pop_back();
+      return t;
+    }
+
+    std::unique_ptr<task> steal(const std::size_t thief) {
+      for (std::size_t i = 1; i < std::size(workers_); ++i) {
+        auto& w = *workers_[(thief + i) % std::size(workers_)];
+        std::scoped_lock lock(w.mutex);
+        if (!w.tasks.empty()) {
+          auto t = std::move(w.tasks.front());
+          w.tasks.pop_front();
+          return t;
+        }
+      }
+      return nullptr;
+    }
+
+    std::unique_ptr<task> take(const std::size_t index) {
+      auto t = pop(index);
+      if (!t) {
+        t = steal(index);
+      }
+      if (t) {
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+      }
+      return t;
+    }
+
+    static std::string error_message(lua_State* L) {
+      const auto msg = lua_tostring(L, -1);
+      return msg ? msg : "(error object is not a string)";
+    }
+
+    static void run(lua_State* L, task& t) {
+      const auto top = lua_gettop(L);
+      try {
+        if (luaL_loadbuffer(L, std::data(t.code), std::size(t.code), t.chunkname.c_str()) != 0) {
+          throw std::runtime_error(error_message(L));
+        }
+        const auto nargs = marshal::push(L, t.args);
+        if (lua_pcall(L, nargs, LUA_MULTRET, 0) != 0) {
+          throw std::runtime_error(error_message(L));
+        }
+        auto values = marshal::from_stack(L, top + 1, lua_gettop(L) - top);
+        lua_settop(L, top);
+        t.promise.set_value({ true, std::move(values), {} });
+      }
+      catch (const std::exception& e) {
+        lua_settop(L, top);
+        t.promise.set_value({ false, {}, e.what() });
+      }
+    }
+
+    void worker_loop(const std::size_t index) {
+      module_refs modules;
+      sol::state lua;
+      manager::get_instance().init_state(lua, modules);
+      current_ = { this, index, lua.lua_state() };
+
+      while (true) {
+        if (auto t = take(index)) {
+          run(lua.lua_state(), *t);
+          continue;
+        }
+
+        std::unique_lock lock(idle_mutex_);
+        idle_cv_.wait(lock, [this] { return stop_ || pending_.load(std::memory_order_relaxed) > 0; });
+        if (stop_ && pending_.load(std::memory_order_relaxed) == 0) {
+          break;
+        }
+      }
+    }
+
+  public:
+    explicit impl(const std::size_t workers) {
+      for (std::size_t i = 0; i < workers; ++i) {
+        workers_.push_back(std::make_unique<worker>());
+      }
+      for (std::size_t i = 0; i < workers; ++i) {
+        workers_[i]->thread = std::thread(&impl::worker_loop, this, i);
+      }
+      spdlog::debug("worker pool started with {} workers", workers);
+    }
+
+    ~impl() {
+      {
+        std::scoped_lock lock(idle_mutex_);
+        stop_ = true;
+      }
+      idle_cv_.notify_all();
+      for (auto& w : workers_) {
+        w->thread.join();
+      }
+    }
+
+    ticket submit(std::string code, std::string chunkname, marshal::values args) {
+      auto t = std::make_unique<task>(task{ std::move(code), std::move(chunkname), std::move(args), {} });
+      auto future = t->promise.get_future().share();
+
+      // nested submits stay local to the submitting worker
+      const auto index = current_.pool == this ? current_.index : next_.fetch_add(1, std::memory_order_relaxed) % std::size(workers_);
+      {
+        auto& w = *workers_[index];
+        std::scoped_lock lock(w.mutex);
+        w.tasks.push_back(std::move(t));
+      }
+      {
+        std::scoped_lock lock(idle_mutex_);
+        pending_.fetch_add(1, std::memory_order_relaxed);
+      }
+      idle_cv_.notify_one();
+
+      return future;
+    }
+
+    const result& wait(const ticket& t) {
+      if (current_.pool == this) {
+        using namespace std::chrono_literals;
+        while (t.wait_for(0s) != std::future_status::ready) {
+          if (auto other = take(current_.index)) {
+            run(current_.L, *other);
+          }
+          else {
+            t.wait_for(1ms);
+          }
+        }
+      }
+      return t.get();
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept {
+      return std::size(workers_);
+    }
+  };
+
+  worker_pool::worker_pool(const std::size_t workers) : impl_(std::make_unique<impl>(workers)) {
+  }
+
+  worker_pool::~worker_pool() = default;
+
+  worker_pool& worker_pool::get_instance() {
+    static worker_pool instance((std::max)(std::thread::hardware_concurrency(), 1u));
+    return instance;
+  }
+
+  worker_pool::ticket worker_pool::submit(std::string code, std::string chunkname, marshal::values args) {
+    return impl_->submit(std::move(code), std::move(chunkname), std::move(args));
+  }
+
+  const worker_pool::result& worker_pool::wait(const ticket& t) {
+    return impl_->wait(t);
+  }
+
+  std::size_t worker_pool::size() const noexcept {
+    return impl_->size();
+  }
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <future>
+
+#include "marshal.h"
+
+namespace rostrum {
+  /*
+   * Pool of worker threads, each owning its own lua state initialized by manager::init_state.
+   * Every worker has its own task queue; idle workers steal tasks from the others.
+   */
+  class worker_pool final {
+  public:
+    struct result {
+      bool ok;
+      marshal::values values;
+      std::string error;
+    };
+
+    using ticket = std::shared_future<result>;
+
+  private:
+    explicit worker_pool(std::size_t workers);
+    ~worker_pool();
+
+  public:
+    static worker_pool& get_instance();
+
+    // @code is either lua source or bytecode. @args are passed to the loaded chunk
+    [[nodiscard]] ticket submit(std::string code, std::string chunkname, marshal::values args);
+
+    // wait for ticket. workers keep executing pending tasks while waiting to not deadlock on nested submits
+    const result& wait(const ticket& t);
+
+    [[nodiscard]] std::size_t size() const noexcept;
+
+  private:
+    class impl;
+    std::unique_ptr<impl> impl_;
+  };
+}